@@ -0,0 +1,451 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Benchmarks of card rendering over synthetic decks.
+
+#include <card-gen/backend.hpp>
+#include <card-gen/batch.hpp>
+
+#include <fmt/format.h>
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#include <Psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+	constexpr auto usage =
+		"Usage: card-gen-bench [options] font-filename\n"
+		"Renders synthetic decks that vary card size, element count, markup complexity and image reuse, and reports\n"
+		"throughput, per-stage latency and memory growth, with cold and warm caches. Text is set in font-filename.\n"
+		"Options:\n"
+		"  --cards n          Cards per deck. Default 100.\n"
+		"  --scenario name    Run only the named scenario. May be repeated. Default all.\n"
+		"  --backend name     Render with the \"gl\" (the default) or \"software\" backend.\n"
+		"  --jobs n           Render threads for the end-to-end throughput pass (0 for one per core). Default 0.\n"
+		"  --encoders n       Encoder threads for the end-to-end throughput pass (0 for one per core). Default 0.\n"
+		"  --format name      Encode rendered cards as \"png\" (the default) or \"qoi\".\n"
+		"  --compression n    PNG compression level, from 0 to 9. Default 6.\n"
+		"  --work-dir path    Directory for generated images and rendered cards. Default a temporary directory.\n"
+		"  --json path        Also write the results to path as JSON.\n";
+
+	using clock = std::chrono::steady_clock;
+
+	//! A synthetic deck: every card has the same size and layout, with different text and, unless images are reused,
+	//! different images.
+	struct scenario {
+		std::string name;
+		sf::Vector2i card_size;
+		//! Elements per card, after the static background image. Elements alternate between text and images.
+		unsigned element_count;
+		//! Whether text uses many formatting tags instead of plain text in one font.
+		bool rich_markup;
+		//! The number of distinct foreground images, shared round-robin by all cards, or zero for a distinct image
+		//! per image element.
+		unsigned distinct_images;
+	};
+
+	auto const scenarios = std::vector<scenario>{
+		{"baseline", {500, 700}, 6, false, 4},
+		{"small-cards", {250, 350}, 6, false, 4},
+		{"large-cards", {1500, 2100}, 6, false, 4},
+		{"many-elements", {500, 700}, 24, false, 4},
+		{"rich-markup", {500, 700}, 6, true, 4},
+		{"unique-images", {500, 700}, 6, false, 0},
+	};
+
+	struct arguments {
+		std::string font_path;
+		unsigned card_count = 100;
+		std::vector<std::string> scenario_names;
+		cg::render_backend const* backend = &cg::get_gl_backend();
+		unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+		unsigned encoders = std::max(1u, std::thread::hardware_concurrency());
+		cg::image_format format = cg::image_format::png;
+		std::filesystem::path work_dir = std::filesystem::temp_directory_path() / "card-gen-bench";
+		std::optional<std::string> json_path;
+	};
+
+	auto parse_thread_count(std::string const& value) -> unsigned {
+		auto const result = static_cast<unsigned>(std::stoul(value));
+		return result == 0 ? std::max(1u, std::thread::hardware_concurrency()) : result;
+	}
+
+	auto parse_arguments(int argc, char* argv[]) -> arguments {
+		arguments result;
+		std::vector<std::string> positional;
+		for (int i = 1; i < argc; ++i) {
+			std::string const arg = argv[i];
+			if (arg.rfind("--", 0) != 0) {
+				positional.push_back(arg);
+				continue;
+			}
+			if (i + 1 == argc) { throw std::domain_error{fmt::format("Missing value for option \"{}\".", arg)}; }
+			std::string const value = argv[++i];
+			if (arg == "--cards") {
+				result.card_count = static_cast<unsigned>(std::stoul(value));
+			} else if (arg == "--scenario") {
+				auto const it = std::find_if(
+					scenarios.begin(), scenarios.end(), [&](scenario const& s) { return s.name == value; });
+				if (it == scenarios.end()) { throw std::domain_error{fmt::format("Unknown scenario \"{}\".", value)}; }
+				result.scenario_names.push_back(value);
+			} else if (arg == "--backend") {
+				result.backend = &cg::get_backend(value);
+			} else if (arg == "--jobs") {
+				result.jobs = parse_thread_count(value);
+			} else if (arg == "--encoders") {
+				result.encoders = parse_thread_count(value);
+			} else if (arg == "--format") {
+				result.format = cg::parse_image_format(value);
+			} else if (arg == "--compression") {
+				cg::set_default_compression_level(std::stoi(value));
+			} else if (arg == "--work-dir") {
+				result.work_dir = value;
+			} else if (arg == "--json") {
+				result.json_path = value;
+			} else {
+				throw std::domain_error{fmt::format("Unknown option \"{}\".", arg)};
+			}
+		}
+		if (positional.size() != 1) { return result; }
+		result.font_path = std::filesystem::path{positional.front()}.generic_string();
+		return result;
+	}
+
+	//! The process's current resident memory, in bytes, or zero if it is unavailable.
+	auto get_resident_memory() -> std::size_t {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) { return 0; }
+		return counters.WorkingSetSize;
+#elif defined(__APPLE__)
+		mach_task_basic_info info;
+		mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+		if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count)
+			!= KERN_SUCCESS) {
+			return 0;
+		}
+		return static_cast<std::size_t>(info.resident_size);
+#else
+		// The second field is the resident set, in pages.
+		std::ifstream fin{"/proc/self/statm"};
+		std::size_t total_pages = 0;
+		std::size_t resident_pages = 0;
+		if (!(fin >> total_pages >> resident_pages)) { return 0; }
+		return resident_pages * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+	}
+
+	//! Tracks how far resident memory grows above its level when sampling starts. The process-wide peak that the OS
+	//! reports never decreases, so it would attribute one scenario's peak to every later one; sampling the current
+	//! level instead measures each pass on its own, at the cost of missing peaks between samples.
+	struct memory_sampler {
+		auto sample() -> void {
+			_peak = std::max(_peak, get_resident_memory());
+		}
+
+		//! The largest sampled growth over the starting level, in bytes.
+		auto get_growth() const -> std::size_t {
+			return _peak - _start;
+		}
+
+	private:
+		std::size_t _start = get_resident_memory();
+		std::size_t _peak = _start;
+	};
+
+	//! Generates the source images used by the decks, as PNGs in @p dir named by their index.
+	struct image_source {
+		image_source(std::filesystem::path dir) : _dir{std::move(dir)} {}
+
+		//! The path to the image with index @p index, generating it on first use.
+		auto get(unsigned index) -> std::string const& {
+			while (_paths.size() <= index) {
+				auto const i = static_cast<unsigned>(_paths.size());
+				sf::Image image;
+				image.create(512, 512);
+				for (unsigned y = 0; y < 512; ++y) {
+					for (unsigned x = 0; x < 512; ++x) {
+						auto const color = sf::Color(static_cast<sf::Uint8>(x + 37 * i),
+							static_cast<sf::Uint8>(y + 91 * i),
+							static_cast<sf::Uint8>((x ^ y) + 53 * i));
+						image.setPixel(x, y, color);
+					}
+				}
+				auto path = (_dir / fmt::format("image-{}.png", i)).generic_string();
+				if (!image.saveToFile(path)) {
+					throw std::runtime_error{fmt::format("Could not write benchmark image \"{}\".", path)};
+				}
+				_paths.push_back(std::move(path));
+			}
+			return _paths[index];
+		}
+
+		auto get_paths() const -> std::vector<std::string> const& {
+			return _paths;
+		}
+
+	private:
+		std::filesystem::path _dir;
+		std::vector<std::string> _paths;
+	};
+
+	//! Markup with several tags per line, formatted with the font path, card index and text index.
+	constexpr auto rich_markup =
+		"[font {0}][fill-color ff8000]*Card {1}*\n[outline-thickness 1][outline-color blue]_Line_ [fill-color white]"
+		"{2} /with/ ~mixed~ [outline-thickness 2]*styles*";
+
+	//! Generates the specifications of the cards of scenario @p s, as JSON text, as they would be read from disk.
+	auto make_deck(scenario const& s, unsigned card_count, std::string const& font_path, image_source& images)
+		-> std::vector<std::string> {
+		auto const image_count = s.element_count / 2;
+		auto const text_count = s.element_count - image_count;
+		auto const columns = static_cast<unsigned>(std::ceil(std::sqrt(static_cast<float>(s.element_count))));
+		auto const rows = (s.element_count + columns - 1) / columns;
+		auto const cell_size = sf::Vector2f{1.f / columns, 1.f / rows};
+		auto const text_size = static_cast<unsigned>(std::max(8.f, s.card_size.y * cell_size.y / 6));
+
+		std::vector<std::string> result;
+		result.reserve(card_count);
+		for (unsigned card_index = 0; card_index < card_count; ++card_index) {
+			auto j_elements = nlohmann::json::array();
+			j_elements.push_back({{"image", {{"path", images.get(0)}}}, {"static", true}});
+			for (unsigned e = 0; e < s.element_count; ++e) {
+				auto const cell = sf::Vector2f{(e % columns + 0.5f) * cell_size.x, (e / columns + 0.5f) * cell_size.y};
+				nlohmann::json j_element{{"pos", {cell.x, cell.y}}, {"origin", {0.5, 0.5}}};
+				if (e % 2 == 0) {
+					auto const text_index = card_index * text_count + e / 2;
+					auto markup = s.rich_markup
+						? fmt::format(rich_markup, font_path, card_index, text_index)
+						: fmt::format("[font {}]Card {} line {}", font_path, card_index, text_index);
+					j_element["text"] = {{"markup", std::move(markup)}, {"size", text_size}};
+				} else {
+					// Image 0 is the background, so foreground images start at 1.
+					auto const image_index = card_index * image_count + e / 2;
+					auto const distinct = s.distinct_images == 0 ? image_index : image_index % s.distinct_images;
+					j_element["image"] = {{"path", images.get(1 + distinct)}, {"size", {cell_size.x, cell_size.y}}};
+				}
+				j_elements.push_back(std::move(j_element));
+			}
+			nlohmann::json const j_card{{"id", fmt::format("{}-{}", s.name, card_index)},
+				{"size", {s.card_size.x, s.card_size.y}},
+				{"elements", std::move(j_elements)}};
+			result.push_back(j_card.dump());
+		}
+		return result;
+	}
+
+	//! Forgets every cached font, image, texture and render texture, so that the next card loads everything anew.
+	auto clear_caches(std::string const& font_path, image_source const& images) -> void {
+		cg::font_cache::instance().erase(font_path);
+		cg::texture_cache::instance().clear();
+		cg::base_layer_cache().clear();
+		cg::render_texture_pool::local().clear();
+		for (auto const& path : images.get_paths()) {
+			cg::software_renderer::erase_image(path);
+		}
+	}
+
+	//! Per-card latencies of one stage, in milliseconds.
+	struct stage_latency {
+		char const* name;
+		std::vector<double> samples;
+
+		auto add(clock::duration elapsed) -> void {
+			samples.push_back(std::chrono::duration<double, std::milli>(elapsed).count());
+		}
+
+		auto get_mean() const -> double {
+			double sum = 0;
+			for (auto sample : samples) {
+				sum += sample;
+			}
+			return samples.empty() ? 0 : sum / samples.size();
+		}
+
+		auto get_percentile(double p) const -> double {
+			if (samples.empty()) { return 0; }
+			auto sorted = samples;
+			auto const nth = sorted.begin() + static_cast<std::ptrdiff_t>(p * (sorted.size() - 1));
+			std::nth_element(sorted.begin(), nth, sorted.end());
+			return *nth;
+		}
+
+		auto to_json() const -> nlohmann::json {
+			if (samples.empty()) { return nullptr; }
+			return {{"mean_ms", get_mean()}, {"p50_ms", get_percentile(0.5)}, {"p95_ms", get_percentile(0.95)}};
+		}
+	};
+
+	struct pass_result {
+		std::string scenario_name;
+		bool cold;
+		std::vector<stage_latency> stages;
+		double cards_per_second;
+		//! The growth of resident memory during the pass, sampled after each card.
+		std::size_t memory_growth;
+	};
+
+	//! Times each stage of rendering @p deck on this thread, one card at a time. With the gl backend, "draw" is the
+	//! time to submit the card's draw calls, and "readback" includes waiting for the GPU to finish them. The software
+	//! backend lays out and draws together, so its time is all reported as "draw". Samples resident memory with
+	//! @p memory after each card.
+	auto run_pass(std::vector<std::string> const& deck,
+		bool cold,
+		arguments const& args,
+		image_source const& images,
+		std::string const& output_path,
+		memory_sampler& memory) -> std::vector<stage_latency> {
+		stage_latency parse{"parse"}, layout{"layout"}, draw{"draw"}, readback{"readback"}, encode{"encode"},
+			total{"total"};
+		auto const gl = args.backend == &cg::get_gl_backend();
+		for (auto const& spec : deck) {
+			if (cold) { clear_caches(args.font_path, images); }
+			auto const start = clock::now();
+
+			auto const c = cg::card{nlohmann::json::parse(spec)};
+			auto const parsed = clock::now();
+			parse.add(parsed - start);
+
+			sf::Image image;
+			if (gl) {
+				auto const compiled = c.compile();
+				auto const compiled_time = clock::now();
+				layout.add(compiled_time - parsed);
+
+				auto const lease = cg::render_texture_pool::local().acquire(sf::Vector2u(compiled.get_size()));
+				lease->clear();
+				compiled.draw(*lease);
+				lease->display();
+				auto const drawn = clock::now();
+				draw.add(drawn - compiled_time);
+
+				image = lease->getTexture().copyToImage();
+				readback.add(clock::now() - drawn);
+			} else {
+				image = args.backend->render_image(c);
+				draw.add(clock::now() - parsed);
+			}
+
+			auto const encode_start = clock::now();
+			if (!cg::save_image(image, output_path)) {
+				throw std::runtime_error{fmt::format("Could not write benchmark output \"{}\".", output_path)};
+			}
+			auto const end = clock::now();
+			encode.add(end - encode_start);
+			total.add(end - start);
+			memory.sample();
+		}
+		return {parse, layout, draw, readback, encode, total};
+	}
+
+	//! Renders @p deck end to end with a stream renderer, from parsing to saving.
+	//! @return Cards per second.
+	auto run_throughput(std::vector<std::string> const& deck, arguments const& args, std::string const& output_pattern)
+		-> double {
+		auto const start = clock::now();
+		{
+			cg::stream_renderer renderer{args.jobs, args.encoders, *args.backend};
+			for (auto const& spec : deck) {
+				cg::card c{nlohmann::json::parse(spec)};
+				auto output_path = cg::expand_pattern(output_pattern, c.id);
+				renderer.submit({std::move(c), std::move(output_path)});
+			}
+			for (auto const& error : renderer.finish()) {
+				throw std::runtime_error{error.message};
+			}
+		}
+		return deck.size() / std::chrono::duration<double>(clock::now() - start).count();
+	}
+
+	auto print_pass(pass_result const& pass) -> void {
+		fmt::print("{:<14} {:<5} {:>9.1f} cards/s  resident +{:>7.1f} MiB\n",
+			pass.scenario_name,
+			pass.cold ? "cold" : "warm",
+			pass.cards_per_second,
+			pass.memory_growth / (1024.0 * 1024.0));
+		for (auto const& stage : pass.stages) {
+			if (stage.samples.empty()) { continue; }
+			fmt::print("    {:<9} mean {:>8.3f} ms  p50 {:>8.3f} ms  p95 {:>8.3f} ms\n",
+				stage.name,
+				stage.get_mean(),
+				stage.get_percentile(0.5),
+				stage.get_percentile(0.95));
+		}
+	}
+}
+
+auto main(int argc, char* argv[]) -> int {
+	try {
+		auto const args = parse_arguments(argc, argv);
+		if (args.font_path.empty()) {
+			fmt::print("{}", usage);
+			return 0;
+		}
+
+		std::filesystem::create_directories(args.work_dir);
+		image_source images{args.work_dir};
+		auto const extension = cg::get_extension(args.format);
+		auto const output_path = (args.work_dir / ("output" + extension)).string();
+		auto const output_pattern = (args.work_dir / ("output-{}" + extension)).string();
+
+		auto j_results = nlohmann::json::array();
+		for (auto const& s : scenarios) {
+			auto const& names = args.scenario_names;
+			if (!names.empty() && std::find(names.begin(), names.end(), s.name) == names.end()) { continue; }
+			auto const deck = make_deck(s, args.card_count, args.font_path, images);
+			nlohmann::json j_scenario{{"scenario", s.name}};
+			// The cold pass clears the caches before every card. It primes them for the warm pass.
+			for (bool const cold : {true, false}) {
+				memory_sampler memory;
+				auto const start = clock::now();
+				auto stages = run_pass(deck, cold, args, images, output_path, memory);
+				auto const seconds = std::chrono::duration<double>(clock::now() - start).count();
+				pass_result const pass{s.name, cold, std::move(stages), deck.size() / seconds, memory.get_growth()};
+				print_pass(pass);
+
+				auto& j_pass = j_scenario[cold ? "cold" : "warm"];
+				j_pass["cards_per_second"] = pass.cards_per_second;
+				j_pass["resident_growth_bytes"] = pass.memory_growth;
+				for (auto const& stage : pass.stages) {
+					j_pass["stages"][stage.name] = stage.to_json();
+				}
+			}
+			auto const throughput = run_throughput(deck, args, output_pattern);
+			fmt::print("{:<14} {:<5} {:>9.1f} cards/s  ({} render, {} encoder threads)\n\n",
+				"",
+				"e2e",
+				throughput,
+				args.jobs,
+				args.encoders);
+			j_scenario["end_to_end_cards_per_second"] = throughput;
+			j_results.push_back(std::move(j_scenario));
+		}
+
+		if (args.json_path) {
+			std::ofstream fout{*args.json_path};
+			fout << nlohmann::json{{"cards", args.card_count}, {"results", std::move(j_results)}}.dump(1, '\t') << '\n';
+			if (!fout) { throw std::runtime_error{fmt::format("Could not write results to \"{}\".", *args.json_path)}; }
+		}
+		return 0;
+	} catch (std::exception const& ex) {
+		fmt::print("Error: {}\n", ex.what());
+		return 1;
+	}
+}
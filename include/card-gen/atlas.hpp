@@ -0,0 +1,172 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Rendering of cards into grids on shared sprite sheets.
+
+#pragma once
+
+#include "card-gen.hpp"
+
+#include <SFML/Graphics.hpp>
+#include <fmt/format.h>
+#include <nlohmann/json.hpp>
+
+#include <fstream>
+#include <future>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cg {
+	//! Renders cards directly into the cells of a grid on shared sheets, saving one image per sheet and recording
+	//! where each card was placed. All cards on a sheet have the size of its first card; a card of a different size
+	//! starts a new sheet.
+	struct atlas_writer {
+		//! @param sheet_pattern The output path for sheets, in which each "{}" is replaced with the sheet index.
+		//! @param grid The number of columns and rows of cards per sheet.
+		//! @param writer The writer used to encode and save sheets. It must outlive this atlas writer.
+		atlas_writer(std::string sheet_pattern, sf::Vector2u grid, image_writer& writer)
+			: _sheet_pattern{std::move(sheet_pattern)}, _grid{grid}, _writer{writer} {
+			if (grid.x == 0 || grid.y == 0) { throw std::domain_error{"Atlas grid must have at least one cell."}; }
+		}
+
+		//! Writes any partially filled sheet.
+		~atlas_writer() {
+			finish();
+		}
+
+		atlas_writer(atlas_writer const&) = delete;
+		auto operator=(atlas_writer const&) -> atlas_writer& = delete;
+
+		//! Renders @p c into the next free cell, under the identifier @p id in the manifest.
+		auto add(card const& c, std::string const& id) -> void {
+			auto const compiled = c.compile();
+			auto const cell_size = sf::Vector2u(compiled.get_size());
+			if (_sheet && (cell_size != _sheet->cell_size || _sheet->cell_count == _grid.x * _grid.y)) { flush(); }
+			if (!_sheet) { start_sheet(cell_size); }
+
+			auto& target = *_sheet->texture;
+			auto const target_size = target.getSize();
+			sf::Vector2u const cell{_sheet->cell_count % _grid.x, _sheet->cell_count / _grid.x};
+			sf::Vector2f const pos{float(cell.x * cell_size.x), float(cell.y * cell_size.y)};
+			sf::Vector2f const size{cell_size};
+
+			// Map the card's coordinates onto its cell, clipping anything that falls outside the card.
+			sf::View view{{0, 0, size.x, size.y}};
+			view.setViewport(
+				{pos.x / target_size.x, pos.y / target_size.y, size.x / target_size.x, size.y / target_size.y});
+			target.setView(view);
+			sf::RectangleShape background{size};
+			background.setFillColor(sf::Color::Black);
+			target.draw(background);
+			compiled.draw(target);
+
+			_manifest["cards"].push_back({
+				{"id", id},
+				{"sheet", _sheet_index},
+				{"rect", {pos.x, pos.y, size.x, size.y}},
+				{"uv",
+					{pos.x / target_size.x,
+						pos.y / target_size.y,
+						(pos.x + size.x) / target_size.x,
+						(pos.y + size.y) / target_size.y}},
+			});
+			++_sheet->cell_count;
+		}
+
+		//! Writes any partially filled sheet and waits for all sheets to be saved.
+		//! @return Error messages for sheets that could not be saved.
+		auto finish() -> std::vector<std::string> {
+			if (_sheet) { flush(); }
+			for (auto& [path, saved] : _saves) {
+				if (!saved.get()) { _errors.push_back(fmt::format("Failed to save sheet image to \"{}\".", path)); }
+			}
+			_saves.clear();
+			return std::move(_errors);
+		}
+
+		//! Describes every sheet and where each card was placed, with rectangles in pixels and UVs normalized to the
+		//! sheet size: {"sheets": [{"path", "size"}], "cards": [{"id", "sheet", "rect", "uv"}]}.
+		auto get_manifest() const -> nlohmann::json const& {
+			return _manifest;
+		}
+
+		//! Writes the manifest to @p path as JSON.
+		//! @return Whether the manifest was written successfully.
+		auto save_manifest(std::string const& path) const -> bool {
+			std::ofstream fout{path};
+			fout << _manifest.dump(1, '\t') << '\n';
+			return static_cast<bool>(fout);
+		}
+
+	private:
+		struct sheet {
+			render_texture_pool::lease texture;
+			sf::Vector2u cell_size;
+			unsigned cell_count = 0;
+		};
+
+		std::string _sheet_pattern;
+		sf::Vector2u _grid;
+		image_writer& _writer;
+
+		std::optional<sheet> _sheet;
+		unsigned _sheet_index = 0;
+		nlohmann::json _manifest{{"sheets", nlohmann::json::array()}, {"cards", nlohmann::json::array()}};
+
+		std::vector<std::pair<std::string, std::future<bool>>> _saves;
+		std::vector<std::string> _errors;
+
+		auto sheet_path(unsigned index) const -> std::string {
+			return expand_pattern(_sheet_pattern, std::to_string(index));
+		}
+
+		auto start_sheet(sf::Vector2u cell_size) -> void {
+			sf::Vector2u const size{_grid.x * cell_size.x, _grid.y * cell_size.y};
+			auto const max_size = sf::Texture::getMaximumSize();
+			if (size.x > max_size || size.y > max_size) {
+				throw std::domain_error{fmt::format(
+					"Atlas sheet size {}x{} exceeds the maximum texture size {}.", size.x, size.y, max_size)};
+			}
+			_sheet.emplace(sheet{render_texture_pool::local().acquire(size), cell_size});
+			// Leave unused cells transparent.
+			_sheet->texture->setView(_sheet->texture->getDefaultView());
+			_sheet->texture->clear(sf::Color::Transparent);
+			_manifest["sheets"].push_back({{"path", sheet_path(_sheet_index)}, {"size", {size.x, size.y}}});
+		}
+
+		auto flush() -> void {
+			auto& target = *_sheet->texture;
+			target.setView(target.getDefaultView());
+			target.display();
+			auto path = sheet_path(_sheet_index);
+			auto saved = _writer.submit(target.getTexture().copyToImage(), path);
+			_saves.emplace_back(std::move(path), std::move(saved));
+			_sheet.reset();
+			++_sheet_index;
+		}
+	};
+
+	//! Combines atlas manifests, e.g. from shards of a deck, into one with the sheets of each in order. Each card's
+	//! sheet index is offset by the number of sheets in the manifests before its own.
+	//! @throw std::runtime_error if a manifest is not a valid atlas manifest.
+	inline auto merge_atlas_manifests(std::vector<nlohmann::json> const& manifests) -> nlohmann::json {
+		nlohmann::json result{{"sheets", nlohmann::json::array()}, {"cards", nlohmann::json::array()}};
+		for (auto const& manifest : manifests) {
+			try {
+				auto const offset = result["sheets"].size();
+				for (auto const& j_sheet : manifest.at("sheets")) {
+					result["sheets"].push_back(j_sheet);
+				}
+				for (auto j_card : manifest.at("cards")) {
+					j_card["sheet"] = offset + j_card.at("sheet").get<std::size_t>();
+					result["cards"].push_back(std::move(j_card));
+				}
+			} catch (nlohmann::json::exception const& ex) {
+				throw std::runtime_error{fmt::format("Invalid atlas manifest: {}", ex.what())};
+			}
+		}
+		return result;
+	}
+}
@@ -0,0 +1,99 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Interchangeable ways of rendering cards to images.
+
+#pragma once
+
+#include "card-gen.hpp"
+#include "detail/software_renderer.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace cg {
+	//! A way of rendering cards to images in memory. Backends are stateless and may be used from any thread.
+	struct render_backend {
+		virtual ~render_backend() = default;
+
+		//! The name that selects this backend in get_backend.
+		virtual auto get_name() const -> std::string = 0;
+
+		//! Renders @p c to an image in memory, on the calling thread.
+		virtual auto render_image(card const& c) const -> sf::Image = 0;
+
+		//! Renders @p c into a caller-provided buffer of RGBA pixels; see copy_pixels.
+		//! @throw std::domain_error if the buffer is too small.
+		auto render_pixels(card const& c, std::uint8_t* pixels, std::size_t size, std::size_t stride = 0) const
+			-> void {
+			copy_pixels(render_image(c), pixels, size, stride);
+		}
+
+		//! Renders @p c and encodes it in memory as its output settings specify, as PNG by default.
+		auto render_encoded(card const& c) const -> std::vector<std::uint8_t> {
+			return encode_image(render_image(c), c.output);
+		}
+
+		//! Renders @p c at each of @p scales, in order. The card is laid out and drawn once, at the largest scale, and
+		//! each smaller variant is downsampled from that image with a box filter.
+		auto render_images(card const& c, std::vector<float> const& scales) const -> std::vector<sf::Image> {
+			std::vector<sf::Image> result;
+			if (scales.empty()) { return result; }
+			auto const largest_scale = *std::max_element(scales.begin(), scales.end());
+			auto const largest = largest_scale == 1 ? render_image(c) : render_image(c.scaled(largest_scale));
+			for (auto const scale : scales) {
+				auto const size = sf::Vector2u(get_scaled_size(c.size, scale));
+				if (size == largest.getSize()) {
+					result.push_back(largest);
+				} else {
+					result.push_back(resample(largest, size, resample_filter::box));
+				}
+			}
+			return result;
+		}
+	};
+
+	//! Renders with SFML into an OpenGL render texture, with a GL context per rendering thread.
+	struct gl_backend final : render_backend {
+		auto get_name() const -> std::string override {
+			return "gl";
+		}
+
+		auto render_image(card const& c) const -> sf::Image override {
+			return c.render_image();
+		}
+	};
+
+	//! Renders on the CPU with FreeType glyphs, with no GPU or OpenGL context. Suited to headless hosts, where OpenGL
+	//! may be a slow software implementation or unavailable, and to running many renderers per host.
+	struct software_backend final : render_backend {
+		auto get_name() const -> std::string override {
+			return "software";
+		}
+
+		auto render_image(card const& c) const -> sf::Image override {
+			return software_renderer::local().render_image(c);
+		}
+	};
+
+	inline auto get_gl_backend() -> render_backend const& {
+		static gl_backend const result;
+		return result;
+	}
+
+	inline auto get_software_backend() -> render_backend const& {
+		static software_backend const result;
+		return result;
+	}
+
+	//! Gets the backend named @p name: "gl" or "software".
+	//! @throw std::domain_error if there is no backend named @p name.
+	inline auto get_backend(std::string const& name) -> render_backend const& {
+		if (name == "gl") { return get_gl_backend(); }
+		if (name == "software") { return get_software_backend(); }
+		throw std::domain_error{fmt::format("Unknown backend \"{}\"; expected \"gl\" or \"software\".", name)};
+	}
+}
@@ -0,0 +1,219 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Rendering of many cards at once.
+
+#pragma once
+
+#include "backend.hpp"
+#include "card-gen.hpp"
+#include "detail/bounded_queue.hpp"
+#include "detail/worker_pool.hpp"
+
+#include <fmt/format.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace cg {
+	//! A card to render and the path its image should be written to.
+	struct render_job {
+		cg::card card;
+		std::string output_path;
+		//! Scales to render the card at, or empty to render it once at its own size. Each variant is written to
+		//! output_path with "@<scale>x" inserted before the extension (see get_scaled_path).
+		std::vector<float> scales;
+
+		//! The paths the job's images are written to.
+		auto get_output_paths() const -> std::vector<std::string> {
+			if (scales.empty()) { return {output_path}; }
+			std::vector<std::string> result;
+			for (auto const scale : scales) {
+				result.push_back(get_scaled_path(output_path, scale));
+			}
+			return result;
+		}
+
+		//! Renders the job's images with @p backend, in the order of get_output_paths.
+		auto render_images(render_backend const& backend) const -> std::vector<sf::Image> {
+			if (scales.empty()) { return {backend.render_image(card)}; }
+			return backend.render_images(card, scales);
+		}
+	};
+
+	//! A job that failed to render, or to save some of its images.
+	struct render_error {
+		//! The job's output_path.
+		std::string output_path;
+		//! The paths of the job's images that were not written: all of them if the job failed to render.
+		std::vector<std::string> failed_paths;
+		std::string message;
+	};
+
+	//! Renders @p jobs with @p backend across @p thread_count threads, each with its own render context. Rendered
+	//! images are handed to @p encoder_count encoder threads, which save them while the next cards are drawn.
+	//! @return For each job, an empty string on success or else an error message.
+	inline auto render_batch(std::vector<render_job> const& jobs,
+		unsigned thread_count = 1,
+		unsigned encoder_count = 1,
+		render_backend const& backend = get_gl_backend()) -> std::vector<std::string> {
+		std::vector<std::string> errors(jobs.size());
+		// Each job's output paths and pending saves.
+		std::vector<std::vector<std::pair<std::string, std::future<bool>>>> saves(jobs.size());
+		{
+			image_writer writer{encoder_count};
+			parallel_for(jobs.size(), thread_count, [&](std::size_t i) {
+				auto const& job = jobs[i];
+				try {
+					auto images = job.render_images(backend);
+					auto const output_paths = job.get_output_paths();
+					for (std::size_t j = 0; j < images.size(); ++j) {
+						saves[i].emplace_back(
+							output_paths[j], writer.submit(std::move(images[j]), output_paths[j], job.card.output));
+					}
+				} catch (std::exception const& ex) { errors[i] = ex.what(); }
+			});
+			// Destroying the writer waits for the remaining saves.
+		}
+		for (std::size_t i = 0; i < jobs.size(); ++i) {
+			for (auto& [output_path, saved] : saves[i]) {
+				if (!saved.get()) { errors[i] = fmt::format("Failed to save card image to \"{}\".", output_path); }
+			}
+		}
+		return errors;
+	}
+
+	//! Renders cards as they are submitted with @p backend, on @p thread_count render threads and @p encoder_count
+	//! encoder threads. Only a bounded number of cards are queued or in flight at once, so memory use does not grow
+	//! with deck size. If @p frames is not null, rendered images are written to it as raw frames named by their
+	//! output paths instead of being saved. If @p on_thread_start is set, each render thread calls it before taking its
+	//! first card, e.g. to prewarm its caches; it must not throw.
+	struct stream_renderer {
+		stream_renderer(unsigned thread_count = 1,
+			unsigned encoder_count = 1,
+			render_backend const& backend = get_gl_backend(),
+			frame_sink* frames = nullptr,
+			std::function<void()> on_thread_start = {})
+			: _backend{backend}
+			, _writer{encoder_count, 0, frames}
+			, _queue{std::size_t{2} * std::max(thread_count, 1u)} {
+			for (unsigned i = 0; i < std::max(thread_count, 1u); ++i) {
+				_threads.emplace_back([this, on_thread_start] {
+					if (on_thread_start) { on_thread_start(); }
+					run();
+				});
+			}
+		}
+
+		~stream_renderer() {
+			finish();
+		}
+
+		stream_renderer(stream_renderer const&) = delete;
+		auto operator=(stream_renderer const&) -> stream_renderer& = delete;
+
+		//! Queues @p job for rendering, blocking while the queue is full.
+		auto submit(render_job job) -> void {
+			{
+				std::lock_guard lock{_errors_mutex};
+				++_pending;
+			}
+			if (!_queue.push(std::move(job))) { complete(); }
+		}
+
+		//! Waits for all submitted jobs to be rendered and saved, keeping the render threads and their contexts alive
+		//! for further jobs.
+		//! @return The failures of jobs since the last call to wait, in no particular order.
+		auto wait() -> std::vector<render_error> {
+			std::unique_lock lock{_errors_mutex};
+			_idle.wait(lock, [this] { return _pending == 0; });
+			return std::move(_errors);
+		}
+
+		//! Waits for all submitted jobs to be rendered and saved. No jobs may be submitted afterward.
+		//! @return The failures of jobs since the last call to wait, in no particular order.
+		auto finish() -> std::vector<render_error> {
+			_queue.close();
+			for (auto& thread : _threads) {
+				if (thread.joinable()) { thread.join(); }
+			}
+			std::lock_guard lock{_errors_mutex};
+			return std::move(_errors);
+		}
+
+	private:
+		render_backend const& _backend;
+		image_writer _writer;
+		bounded_queue<render_job> _queue;
+		std::vector<std::thread> _threads;
+
+		std::mutex _errors_mutex;
+		std::condition_variable _idle;
+		std::vector<render_error> _errors;
+		//! The number of submitted jobs that are not yet rendered and saved.
+		std::size_t _pending = 0;
+
+		auto add_error(render_error error) -> void {
+			std::lock_guard lock{_errors_mutex};
+			_errors.push_back(std::move(error));
+		}
+
+		//! Marks a submitted job as done.
+		auto complete() -> void {
+			{
+				std::lock_guard lock{_errors_mutex};
+				--_pending;
+			}
+			_idle.notify_all();
+		}
+
+		auto run() -> void {
+			// Each job's output path and pending saves, oldest job first.
+			struct job_saves {
+				std::string output_path;
+				std::vector<std::pair<std::string, std::future<bool>>> saves;
+			};
+			std::deque<job_saves> saves;
+			auto const wait_for_oldest_save = [&] {
+				auto& oldest = saves.front();
+				for (auto& [path, saved] : oldest.saves) {
+					if (!saved.get()) {
+						auto message = fmt::format("Failed to save card image to \"{}\".", path);
+						add_error({oldest.output_path, {path}, std::move(message)});
+					}
+				}
+				saves.pop_front();
+				complete();
+			};
+			for (;;) {
+				// Block for the next job only when no saves are pending, so that an idle thread settles its saves.
+				auto job = saves.empty() ? _queue.pop() : _queue.try_pop();
+				if (!job) {
+					if (saves.empty()) { return; }
+					wait_for_oldest_save();
+					continue;
+				}
+				try {
+					auto images = job->render_images(_backend);
+					auto const output_paths = job->get_output_paths();
+					auto& current = saves.emplace_back(job_saves{job->output_path, {}});
+					for (std::size_t i = 0; i < images.size(); ++i) {
+						current.saves.emplace_back(
+							output_paths[i], _writer.submit(std::move(images[i]), output_paths[i], job->card.output));
+					}
+				} catch (std::exception const& ex) {
+					add_error({job->output_path, job->get_output_paths(), ex.what()});
+					complete();
+				}
+				// Keep only a few saves pending per thread, so their results do not accumulate.
+				if (saves.size() > 2) { wait_for_oldest_save(); }
+			}
+		}
+	};
+}
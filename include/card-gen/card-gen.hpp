@@ -1,36 +1,81 @@
 //! @file
 //! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
 
+#pragma once
+
+#include "detail/font_cache.hpp"
+#include "detail/image_writer.hpp"
+#include "detail/interned_string.hpp"
+#include "detail/layout_cache.hpp"
+#include "detail/profiler.hpp"
+#include "detail/render_texture_pool.hpp"
+#include "detail/resample.hpp"
 #include "detail/rich_text.hpp"
+#include "detail/texture_cache.hpp"
 #include "detail/visitation.hpp"
 
 #include <SFML/Graphics.hpp>
 #include <fmt/format.h>
 #include <nlohmann/json.hpp>
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <future>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <variant>
+#include <vector>
 
 namespace cg {
 	struct text {
 		sf::String markup;
 		unsigned size;
 
-		text(sf::String markup, std::string font, unsigned size) : markup{markup}, size{size} {}
+		text(sf::String markup, std::string font, unsigned size) : markup{std::move(markup)}, size{size} {}
 
 		text(nlohmann::json const& j) : markup{j.at("markup").get<std::string>()}, size{j.at("size")} {}
+
+		auto to_json() const -> nlohmann::json {
+			auto const utf8 = markup.toUtf8();
+			return {{"markup", std::string(utf8.begin(), utf8.end())}, {"size", size}};
+		}
 	};
 
 	struct image {
-		std::string path;
+		//! Interned, since cards typically share a few images, so copying an image element allocates nothing.
+		interned_string path;
 		sf::Vector2f size;
+		//! How the image is resized to its on-card size, or empty to use the default resample filter.
+		std::optional<resample_filter> filter;
 
-		image(std::string path, sf::Vector2f size = {1, 1}) : path{path}, size{size} {}
+		image(interned_string path, sf::Vector2f size = {1, 1}, std::optional<resample_filter> filter = std::nullopt)
+			: path{path}, size{size}, filter{filter} {}
 
 		image(nlohmann::json const& j) : path{j.at("path").get<std::string>()} {
 			auto size_it = j.find("size");
 			size = size_it == j.end() ? sf::Vector2f{1, 1} : sf::Vector2f{size_it->at(0), size_it->at(1)};
+			auto filter_it = j.find("filter");
+			if (filter_it != j.end()) { filter = parse_resample_filter(filter_it->get<std::string>()); }
+		}
+
+		auto to_json() const -> nlohmann::json {
+			nlohmann::json result{{"path", path.str()}, {"size", {size.x, size.y}}};
+			if (filter) { result["filter"] = to_string(*filter); }
+			return result;
+		}
+
+		//! The image's size on a card of size @p card_size, in whole pixels.
+		auto get_pixel_size(sf::Vector2i card_size) const -> sf::Vector2u {
+			return {static_cast<unsigned>(std::max(1.f, std::roundf(std::abs(size.x * card_size.x)))),
+				static_cast<unsigned>(std::max(1.f, std::roundf(std::abs(size.y * card_size.y))))};
 		}
 	};
 
@@ -38,21 +83,109 @@ namespace cg {
 		std::variant<text, image> text_or_image;
 		sf::Vector2f pos{0, 0};
 		sf::Vector2f origin{0, 0};
+		//! Whether this element is the same in every card that shares it. A card's leading static elements are drawn
+		//! once into a cached base layer shared by all cards with the same leading static elements.
+		bool is_static = false;
+
+		auto to_json() const -> nlohmann::json {
+			nlohmann::json result{{"pos", {pos.x, pos.y}}, {"origin", {origin.x, origin.y}}, {"static", is_static}};
+			match(
+				text_or_image,
+				[&](text const& t) { result["text"] = t.to_json(); },
+				[&](image const& i) { result["image"] = i.to_json(); });
+			return result;
+		}
 	};
 
+	//! Inserts "@<scale>x" before the extension of @p path, naming the variant of an output at @p scale.
+	inline auto get_scaled_path(std::string const& path, float scale) -> std::string {
+		std::filesystem::path result{path};
+		result.replace_filename(fmt::format("{}@{}x{}", result.stem().string(), scale, result.extension().string()));
+		return result.string();
+	}
+
+	//! The size of @p size scaled by @p scale, in whole pixels.
+	inline auto get_scaled_size(sf::Vector2i size, float scale) -> sf::Vector2i {
+		return {std::max(1, static_cast<int>(std::roundf(size.x * scale))),
+			std::max(1, static_cast<int>(std::roundf(size.y * scale)))};
+	}
+
+	//! Replaces each "{}" in the output path @p pattern with @p id.
+	inline auto expand_pattern(std::string pattern, std::string const& id) -> std::string {
+		for (auto pos = pattern.find("{}"); pos != std::string::npos; pos = pattern.find("{}", pos + id.size())) {
+			pattern.replace(pos, 2, id);
+		}
+		return pattern;
+	}
+
+	//! Cache of rendered base layers, shared by cards with identical leading static elements.
+	inline auto base_layer_cache() -> texture_cache& {
+		static texture_cache result;
+		return result;
+	}
+
+	//! Copies the RGBA pixels of @p image into the @p size bytes at @p pixels, with rows @p stride bytes apart, or
+	//! tightly packed if @p stride is zero.
+	//! @throw std::domain_error if @p stride is shorter than a row or the buffer is too small for the image.
+	inline auto copy_pixels(sf::Image const& image, std::uint8_t* pixels, std::size_t size, std::size_t stride = 0)
+		-> void {
+		auto const image_size = image.getSize();
+		std::size_t const row_size = std::size_t{4} * image_size.x;
+		if (stride == 0) { stride = row_size; }
+		if (stride < row_size) {
+			throw std::domain_error{
+				fmt::format("Pixel buffer stride {} is shorter than a row of {} bytes.", stride, row_size)};
+		}
+		if (image_size.y > 0 && size < stride * (image_size.y - 1) + row_size) {
+			throw std::domain_error{fmt::format("Pixel buffer of {} bytes is too small for a {}x{} image.",
+				size,
+				image_size.x,
+				image_size.y)};
+		}
+		auto const source = image.getPixelsPtr();
+		for (std::size_t y = 0; y < image_size.y; ++y) {
+			std::memcpy(pixels + y * stride, source + y * row_size, row_size);
+		}
+	}
+
+	struct compiled_card;
+
 	struct card {
+		//! Optional identifier, used to name the card's output when rendering a deck.
+		std::string id;
 		sf::Vector2i size;
 		std::vector<element> elements;
+		//! How the card's image is encoded. Unset fields fall back to the output path's extension and the default
+		//! compression level.
+		encoder_settings output;
 
 		card(sf::Vector2i size) : size{size} {}
 
 		card(nlohmann::json const& j) {
+			scoped_timer const timer{"read card"};
+			// Get card ID, if any.
+			auto const id_it = j.find("id");
+			if (id_it != j.end()) { id = id_it->get<std::string>(); }
+
 			// Get card size.
 			auto j_size = j.at("size");
 			size = {j_size.at(0), j_size.at(1)};
 
+			// Get output format and compression level, if any.
+			auto const output_it = j.find("output");
+			if (output_it != j.end()) {
+				auto const format_it = output_it->find("format");
+				if (format_it != output_it->end()) {
+					output.format = parse_image_format(format_it->get<std::string>());
+				}
+				auto const level_it = output_it->find("level");
+				if (level_it != output_it->end()) { output.level = check_compression_level(level_it->get<int>()); }
+			}
+
 			// Get card elements.
-			for (auto const& j_element : j["elements"]) {
+			auto const& j_elements = j["elements"];
+			elements.reserve(j_elements.size());
+			for (auto const& j_element : j_elements) {
 				// Get position; default to top-left.
 				auto const pos_it = j_element.find("pos");
 				sf::Vector2f const pos = pos_it == j_element.end() //
@@ -76,44 +209,304 @@ namespace cg {
 					}
 				}();
 
-				elements.push_back({text_or_image, pos, origin});
+				// Elements are dynamic unless marked static.
+				bool const is_static = j_element.value("static", false);
+
+				elements.push_back({text_or_image, pos, origin, is_static});
 			}
 		}
 
-		auto render(std::string const& output_path) const -> bool {
-			sf::RenderTexture card_texture;
-			card_texture.create(size.x, size.y);
-			card_texture.clear();
+		//! The card's specification, in the form accepted by the JSON constructor.
+		auto to_json() const -> nlohmann::json {
+			nlohmann::json result{{"size", {size.x, size.y}}, {"elements", nlohmann::json::array()}};
+			if (!id.empty()) { result["id"] = id; }
+			if (output.format) { result["output"]["format"] = to_string(*output.format); }
+			if (output.level) { result["output"]["level"] = *output.level; }
+			for (auto const& element : elements) {
+				result["elements"].push_back(element.to_json());
+			}
+			return result;
+		}
+
+		//! Replaces each setting the card leaves to a process-wide default, namely its compression level and each
+		//! image's resample filter, with the current default, so that its JSON records how it will be rendered.
+		auto resolve_defaults() -> void {
+			if (!output.level) { output.level = get_default_compression_level(); }
+			for (auto& element : elements) {
+				if (auto const i = std::get_if<image>(&element.text_or_image); i && !i->filter) {
+					i->filter = get_default_resample_filter();
+				}
+			}
+		}
+
+		//! Gets the paths of the fonts used by the card's text, without duplicates.
+		auto referenced_fonts() const -> std::vector<std::string> {
+			std::vector<std::string> result;
+			for (auto const& element : elements) {
+				if (auto const t = std::get_if<text>(&element.text_or_image)) {
+					for (auto& path : sfe::rich_text::referenced_fonts(t->markup)) {
+						if (std::find(result.begin(), result.end(), path) == result.end()) {
+							result.push_back(std::move(path));
+						}
+					}
+				}
+			}
+			return result;
+		}
 
+		//! Gets the paths of the card's images, without duplicates.
+		auto referenced_images() const -> std::vector<std::string> {
+			std::vector<std::string> result;
 			for (auto const& element : elements) {
-				sf::Vector2f const rounded_pos{std::roundf(size.x * element.pos.x), std::roundf(size.y * element.pos.y)};
+				if (auto const i = std::get_if<image>(&element.text_or_image)) {
+					if (std::find(result.begin(), result.end(), i->path.str()) == result.end()) {
+						result.push_back(i->path);
+					}
+				}
+			}
+			return result;
+		}
+
+		//! Adds the glyphs used by the card's text to @p glyphs, which maps font paths to glyph sets. Each font's set
+		//! covers every character the card sets in that font in every style the card uses with that font.
+		//! @throw std::domain_error if the card's text markup is invalid.
+		auto add_referenced_glyphs(std::map<std::string, glyph_set>& glyphs) const -> void {
+			for (auto const& element : elements) {
+				auto const t = std::get_if<text>(&element.text_or_image);
+				if (!t) { continue; }
+				for (auto const& line : sfe::rich_text::parse(t->markup)) {
+					for (auto const& span : line) {
+						if (span.font_path.empty()) { continue; }
+						auto& set = glyphs[span.font_path];
+						bool const bold = span.style_flags & sf::Text::Bold;
+						// Outlined text draws its fill with unoutlined glyphs.
+						set.add_style({t->size, bold, 0});
+						if (span.outline_thickness != 0) { set.add_style({t->size, bold, span.outline_thickness}); }
+						set.characters.insert(span.text.begin(), span.text.end());
+						// Layout measures spaces, and strikethrough and underline placement measure 'x'.
+						set.characters.insert({U' ', U'x'});
+					}
+				}
+			}
+		}
+
+		//! Gets a copy of the card scaled by @p scale: its size and text sizes are scaled, and since positions, origins
+		//! and image sizes are relative to the card's size, the layout scales with them.
+		//! @note Outline thicknesses given in text markup are in pixels and are not scaled.
+		auto scaled(float scale) const -> card {
+			card result = *this;
+			result.size = get_scaled_size(size, scale);
+			for (auto& element : result.elements) {
+				if (auto const t = std::get_if<text>(&element.text_or_image)) {
+					t->size = std::max(1u, static_cast<unsigned>(std::roundf(t->size * scale)));
+				}
+			}
+			return result;
+		}
+
+		//! Parses and lays out the card's text and loads its images, for rendering repeatedly.
+		auto compile() const -> compiled_card;
+
+		//! Renders the card and saves it to @p output_path, encoded as the card's output settings specify.
+		//! @return Whether the image was saved successfully.
+		auto render(std::string const& output_path) const -> bool;
+
+		//! Renders the card and queues it on @p writer to be encoded as the card's output settings specify and saved to
+		//! @p output_path, so the caller can render the next card in the meantime.
+		//! @return A future that becomes true if the image was saved successfully or false otherwise.
+		auto render_async(image_writer& writer, std::string const& output_path) const -> std::future<bool>;
+
+		//! Renders the card to an image in memory.
+		auto render_image() const -> sf::Image;
+
+		//! Renders the card into a caller-provided buffer of RGBA pixels; see copy_pixels.
+		//! @throw std::domain_error if the buffer is too small.
+		auto render_pixels(std::uint8_t* pixels, std::size_t size, std::size_t stride = 0) const -> void;
+
+		//! Renders the card and encodes it in memory as the card's output settings specify, as PNG by default.
+		auto render_encoded() const -> std::vector<std::uint8_t>;
+	};
+
+	//! Parses a card from its JSON specification, such as a request body.
+	//! @throw nlohmann::json::exception if @p json_text is not a valid card specification.
+	inline auto parse_card(std::string_view json_text) -> card {
+		scoped_timer parse_timer{"parse json"};
+		auto const j = nlohmann::json::parse(json_text.begin(), json_text.end());
+		parse_timer.stop();
+		return card{j};
+	}
+
+	//! A card whose text has been parsed and laid out and whose images have been loaded, so it can be rendered
+	//! repeatedly without repeating that work.
+	//! @note Laid-out text refers to the fonts of the thread that compiled it, so a compiled card should only be
+	//! rendered on that thread.
+	struct compiled_card {
+		compiled_card(card const& c) : _size{c.size} {
+			scoped_timer const timer{"compile card"};
+			// Draw the leading run of static elements once into a shared base layer. Static elements after the first
+			// dynamic one must still be drawn in order, on top of it.
+			auto const static_end = std::find_if_not(
+				c.elements.begin(), c.elements.end(), [](element const& e) { return e.is_static; });
+			if (static_end != c.elements.begin()) {
+				auto base_key = nlohmann::json::array();
+				base_key.push_back({c.size.x, c.size.y});
+				for (auto it = c.elements.begin(); it != static_end; ++it) {
+					base_key.push_back(it->to_json());
+				}
+				auto base_texture = base_layer_cache().get(base_key.dump(), [&](sf::Texture& texture) {
+					compiled_card base{c.size};
+					for (auto it = c.elements.begin(); it != static_end; ++it) {
+						base.add_layer(*it);
+					}
+					if (!texture.loadFromImage(base.render_image())) {
+						throw std::runtime_error{"Could not create base layer texture."};
+					}
+				});
+				sf::Sprite base_sprite{*base_texture};
+				_layers.push_back({base_sprite, std::move(base_texture)});
+			}
+			for (auto it = static_end; it != c.elements.end(); ++it) {
+				add_layer(*it);
+			}
+		}
+
+		auto get_size() const -> sf::Vector2i {
+			return _size;
+		}
+
+		//! Renders the card and saves it to @p output_path, encoded as @p settings specify.
+		//! @return Whether the image was saved successfully.
+		auto render(std::string const& output_path, encoder_settings const& settings = {}) const -> bool {
+			return save_image(render_image(), output_path, settings);
+		}
+
+		//! Renders the card and queues it on @p writer to be encoded as @p settings specify and saved to
+		//! @p output_path.
+		//! @return A future that becomes true if the image was saved successfully or false otherwise.
+		auto render_async(image_writer& writer, std::string const& output_path, encoder_settings const& settings = {})
+			const -> std::future<bool> {
+			return writer.submit(render_image(), output_path, settings);
+		}
+
+		//! Renders the card to an image in memory.
+		auto render_image() const -> sf::Image {
+			// Reuse a render texture from an earlier card of the same size if possible.
+			auto const card_texture_lease = render_texture_pool::local().acquire(sf::Vector2u(_size));
+			auto& card_texture = *card_texture_lease;
+			scoped_timer draw_timer{"draw card"};
+			card_texture.clear();
+			draw(card_texture);
+			card_texture.display();
+			draw_timer.stop();
+			// Reading back waits for the GPU to finish drawing.
+			scoped_timer const readback_timer{"read back card"};
+			return card_texture.getTexture().copyToImage();
+		}
+
+		//! Renders the card into a caller-provided buffer of RGBA pixels; see copy_pixels.
+		//! @throw std::domain_error if the buffer is too small.
+		auto render_pixels(std::uint8_t* pixels, std::size_t size, std::size_t stride = 0) const -> void {
+			copy_pixels(render_image(), pixels, size, stride);
+		}
+
+		//! Renders the card and encodes it in memory as @p settings specify, as PNG by default.
+		auto render_encoded(encoder_settings const& settings = {}) const -> std::vector<std::uint8_t> {
+			return encode_image(render_image(), settings);
+		}
+
+		//! Draws the card's elements onto @p target, with the card's top-left corner at the origin of @p states.
+		auto draw(sf::RenderTarget& target, sf::RenderStates const& states = sf::RenderStates::Default) const -> void {
+			for (auto const& layer : _layers) {
 				match(
-					element.text_or_image,
-					[&](text t) {
-						sfe::rich_text rich_text{t.markup, t.size};
-						rich_text.setPosition(rounded_pos);
-						auto const bounds = rich_text.get_local_bounds();
-						rich_text.setOrigin( //
-							std::roundf(bounds.width * element.origin.x),
-							std::roundf(bounds.height * element.origin.y));
-						card_texture.draw(rich_text);
+					layer.drawable,
+					[&](placed_text const& placed) {
+						auto text_states = states;
+						text_states.transform *= placed.transform;
+						target.draw(*placed.text, text_states);
 					},
-					[&](image i) {
-						sf::Texture image_texture;
-						image_texture.loadFromFile(i.path);
-						sf::Sprite image_sprite{image_texture};
-						image_sprite.setPosition(rounded_pos);
-						auto const image_texture_size = image_texture.getSize();
-						image_sprite.setScale(
-							i.size.x * size.x / image_texture_size.x, i.size.y * size.y / image_texture_size.y);
-						image_sprite.setOrigin( //
-							std::roundf(image_texture_size.x * element.origin.x),
-							std::roundf(image_texture_size.y * element.origin.y));
-						card_texture.draw(image_sprite);
+					[&](sf::Sprite const& sprite) {
+						target.draw(sprite, states);
+						count("draw calls");
 					});
 			}
-			card_texture.display();
-			return card_texture.getTexture().copyToImage().saveToFile(output_path);
 		}
+
+	private:
+		//! Creates an empty compiled card.
+		compiled_card(sf::Vector2i size) : _size{size} {}
+
+		//! Lays out @p element and adds it as the top layer.
+		auto add_layer(element const& element) -> void {
+			sf::Vector2f const rounded_pos{std::roundf(_size.x * element.pos.x), std::roundf(_size.y * element.pos.y)};
+			match(
+				element.text_or_image,
+				[&](text const& t) {
+					// Identical text is often repeated across cards, so share its layout through the cache.
+					auto layout = layout_cache::local().get(t.markup, t.size);
+					auto const bounds = layout->get_local_bounds();
+					sf::Transformable placement;
+					placement.setPosition(rounded_pos);
+					placement.setOrigin( //
+						std::roundf(bounds.width * element.origin.x),
+						std::roundf(bounds.height * element.origin.y));
+					_layers.push_back({placed_text{std::move(layout), placement.getTransform()}, nullptr});
+				},
+				[&](image const& i) {
+					// Images are typically shared across many cards, so load them through the cache, resampled to their
+					// exact on-card size unless they are scaled when drawn.
+					auto const filter = i.filter.value_or(get_default_resample_filter());
+					auto image_texture = filter == resample_filter::none
+						? texture_cache::instance().get(i.path)
+						: texture_cache::instance().get(i.path, i.get_pixel_size(_size), filter);
+					sf::Sprite image_sprite{*image_texture};
+					image_sprite.setPosition(rounded_pos);
+					auto const image_texture_size = image_texture->getSize();
+					image_sprite.setScale(
+						i.size.x * _size.x / image_texture_size.x, i.size.y * _size.y / image_texture_size.y);
+					image_sprite.setOrigin( //
+						std::roundf(image_texture_size.x * element.origin.x),
+						std::roundf(image_texture_size.y * element.origin.y));
+					_layers.push_back({image_sprite, std::move(image_texture)});
+				});
+		}
+
+		//! Laid-out text, possibly shared with other cards, and where it is drawn on this card.
+		struct placed_text {
+			std::shared_ptr<sfe::rich_text const> text;
+			sf::Transform transform;
+		};
+
+		struct layer {
+			std::variant<placed_text, sf::Sprite> drawable;
+			//! Keeps a sprite's texture alive; null for text.
+			std::shared_ptr<sf::Texture const> texture;
+		};
+
+		sf::Vector2i _size;
+		std::vector<layer> _layers;
 	};
+
+	inline auto card::compile() const -> compiled_card {
+		return compiled_card{*this};
+	}
+
+	inline auto card::render(std::string const& output_path) const -> bool {
+		return compile().render(output_path, output);
+	}
+
+	inline auto card::render_async(image_writer& writer, std::string const& output_path) const -> std::future<bool> {
+		return compile().render_async(writer, output_path, output);
+	}
+
+	inline auto card::render_image() const -> sf::Image {
+		return compile().render_image();
+	}
+
+	inline auto card::render_pixels(std::uint8_t* pixels, std::size_t size, std::size_t stride) const -> void {
+		compile().render_pixels(pixels, size, stride);
+	}
+
+	inline auto card::render_encoded() const -> std::vector<std::uint8_t> {
+		return compile().render_encoded(output);
+	}
 }
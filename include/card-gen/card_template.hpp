@@ -0,0 +1,162 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Card layouts with per-card variable substitution.
+
+#pragma once
+
+#include "card-gen.hpp"
+#include "detail/csv.hpp"
+
+#include <fmt/format.h>
+#include <nlohmann/json.hpp>
+
+#include <cctype>
+#include <istream>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace cg {
+	//! Values for a template's placeholders, by name.
+	using template_row = std::map<std::string, std::string>;
+
+	namespace detail {
+		//! If a placeholder "{name}" starts at @p pos in @p source, gets the position of its closing brace.
+		inline auto placeholder_end(std::string const& source, std::size_t pos) -> std::optional<std::size_t> {
+			auto const end = source.find('}', pos + 1);
+			if (end == std::string::npos || end == pos + 1) { return std::nullopt; }
+			for (auto i = pos + 1; i < end; ++i) {
+				auto const c = static_cast<unsigned char>(source[i]);
+				if (!std::isalnum(c) && c != '_' && c != '-') { return std::nullopt; }
+			}
+			return end;
+		}
+	}
+
+	//! Whether @p source contains any placeholders.
+	inline auto has_placeholders(std::string const& source) -> bool {
+		for (auto pos = source.find('{'); pos != std::string::npos; pos = source.find('{', pos + 1)) {
+			if (detail::placeholder_end(source, pos)) { return true; }
+		}
+		return false;
+	}
+
+	//! Replaces each placeholder "{name}" in @p source with the value of "name" in @p row. Braces that do not enclose
+	//! a placeholder name are left as is.
+	//! @throw std::domain_error if @p row has no value for a placeholder.
+	inline auto substitute(std::string const& source, template_row const& row) -> std::string {
+		std::string result;
+		std::size_t copied = 0;
+		for (auto pos = source.find('{'); pos != std::string::npos; pos = source.find('{', pos + 1)) {
+			auto const end = detail::placeholder_end(source, pos);
+			if (!end) { continue; }
+			auto const name = source.substr(pos + 1, *end - pos - 1);
+			auto const value_it = row.find(name);
+			if (value_it == row.end()) {
+				throw std::domain_error{fmt::format("Missing value for placeholder \"{}\".", name)};
+			}
+			result.append(source, copied, pos - copied);
+			result += value_it->second;
+			copied = *end + 1;
+			pos = *end;
+		}
+		result.append(source, copied, std::string::npos);
+		return result;
+	}
+
+	//! A card layout whose text markup and image paths may contain placeholders. The layout is parsed once and then
+	//! instantiated per row of values, substituting only the elements that vary.
+	struct card_template {
+		//! @param j A card specification, whose "markup" and "path" fields may contain placeholders. Elements without
+		//! placeholders are static unless they explicitly set "static" to false.
+		card_template(nlohmann::json const& j) : _layout{j} {
+			std::size_t index = 0;
+			for (auto const& j_element : j["elements"]) {
+				auto const image_it = j_element.find("image");
+				auto const source = image_it != j_element.end() //
+					? image_it->at("path").get<std::string>()
+					: j_element.at("text").at("markup").get<std::string>();
+				auto const variable = has_placeholders(source);
+				_sources.push_back(variable ? std::optional{source} : std::nullopt);
+				auto& element = _layout.elements[index++];
+				element.is_static = variable ? false : j_element.value("static", true);
+			}
+		}
+
+		auto get_layout() const -> card const& {
+			return _layout;
+		}
+
+		//! Whether the element at @p index contains placeholders, meaning it may differ between instances.
+		auto is_variable(std::size_t index) const -> bool {
+			return _sources[index].has_value();
+		}
+
+		//! Creates the card for @p row. Its ID is the row's "id" value, if any.
+		//! @throw std::domain_error if @p row has no value for a placeholder.
+		auto instantiate(template_row const& row) const -> card {
+			card result{_layout.size};
+			auto const id_it = row.find("id");
+			result.id = id_it != row.end() ? id_it->second : _layout.id;
+			result.output = _layout.output;
+			// Copy the elements without placeholders, whose images' paths are interned and so copy without allocating,
+			// and build the others from their substituted values rather than copying and then replacing them.
+			result.elements.reserve(_layout.elements.size());
+			for (std::size_t index = 0; index < _sources.size(); ++index) {
+				auto const& layout_element = _layout.elements[index];
+				if (!_sources[index]) {
+					result.elements.push_back(layout_element);
+					continue;
+				}
+				auto const value = substitute(*_sources[index], row);
+				auto text_or_image = match(
+					layout_element.text_or_image,
+					[&](text const& t) -> std::variant<text, image> { return text{value, {}, t.size}; },
+					[&](image const& i) -> std::variant<text, image> { return image{value, i.size, i.filter}; });
+				result.elements.push_back(
+					{std::move(text_or_image), layout_element.pos, layout_element.origin, layout_element.is_static});
+			}
+			return result;
+		}
+
+	private:
+		card _layout;
+		//! For each element, its unsubstituted markup or image path if it contains placeholders.
+		std::vector<std::optional<std::string>> _sources;
+	};
+
+	//! Reads template rows from a JSON array of objects. Non-string values are converted to their JSON text.
+	inline auto rows_from_json(nlohmann::json const& j) -> std::vector<template_row> {
+		std::vector<template_row> result;
+		for (auto const& j_row : j) {
+			template_row row;
+			for (auto const& [name, value] : j_row.items()) {
+				row[name] = value.is_string() ? value.get<std::string>() : value.dump();
+			}
+			result.push_back(std::move(row));
+		}
+		return result;
+	}
+
+	//! Reads template rows from CSV, where the first record names the columns.
+	//! @throw std::domain_error if a record has more fields than there are columns.
+	inline auto rows_from_csv(std::istream& in) -> std::vector<template_row> {
+		auto const records = read_csv(in);
+		std::vector<template_row> result;
+		if (records.empty()) { return result; }
+		auto const& names = records.front();
+		for (auto it = records.begin() + 1; it != records.end(); ++it) {
+			if (it->size() > names.size()) {
+				throw std::domain_error{fmt::format("CSV record {} has too many fields.", it - records.begin() + 1)};
+			}
+			template_row row;
+			for (std::size_t i = 0; i < it->size(); ++i) {
+				row[names[i]] = (*it)[i];
+			}
+			result.push_back(std::move(row));
+		}
+		return result;
+	}
+}
@@ -0,0 +1,274 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Precompiled binary decks, loaded by memory mapping instead of parsing.
+
+#pragma once
+
+#include "card-gen.hpp"
+#include "detail/mapped_file.hpp"
+
+#include <fmt/format.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cg {
+	//! Layout of binary deck files. All fields are 4-byte values in the writing machine's byte order.
+	//!
+	//! - Header: magic "CGDK", version, card count, string table offset (in 4-byte words, 64 bits over two words).
+	//! - Cards, back to back: ID string index, width, height, output format and compression level (each 0 for the
+	//!   default, else 1 plus the value), element count, then each element:
+	//!   - Kind (0 = text, 1 = image), static flag, position x and y, origin x and y (floats);
+	//!   - Text: character size, markup length, then the markup's UTF-32 code points;
+	//!   - Image: path string index, size x and y (floats), resample filter (0 for the default, else 1 plus the
+	//!     filter's value).
+	//! - String table: string count, then each string's byte length and UTF-8 bytes, padded to 4 bytes.
+	//!
+	//! Strings (IDs and asset paths) are interned, so each distinct asset path is stored and resolved once.
+	namespace deck_format {
+		constexpr char magic[4] = {'C', 'G', 'D', 'K'};
+		constexpr std::uint32_t version = 3;
+		constexpr std::uint32_t no_string = 0xffffffff;
+		constexpr std::uint32_t text_kind = 0;
+		constexpr std::uint32_t image_kind = 1;
+		//! The last value of each enumeration the format stores, so that readers can reject values out of range.
+		constexpr auto last_image_format = image_format::qoi;
+		constexpr auto last_resample_filter = resample_filter::lanczos;
+	}
+
+	//! Writes cards to a binary deck file as they are added.
+	struct deck_writer {
+		//! @throw std::runtime_error if the file could not be opened.
+		deck_writer(std::string const& path) : _path{path}, _fout{path, std::ios::binary} {
+			if (!_fout.is_open()) { throw std::runtime_error{fmt::format("Could not open \"{}\".", path)}; }
+			// Reserve the header; it is filled in by finish.
+			_fout.write(deck_format::magic, sizeof(deck_format::magic));
+			for (int i = 0; i < 4; ++i) {
+				write(0);
+			}
+		}
+
+		//! Finishes the file if finish has not been called, ignoring errors.
+		~deck_writer() {
+			if (!_fout.is_open()) { return; }
+			try {
+				finish();
+			} catch (std::exception const&) {}
+		}
+
+		deck_writer(deck_writer const&) = delete;
+		auto operator=(deck_writer const&) -> deck_writer& = delete;
+
+		auto add(card const& c) -> void {
+			write(c.id.empty() ? deck_format::no_string : intern(c.id));
+			write(c.size.x);
+			write(c.size.y);
+			write(c.output.format ? std::uint32_t{1} + static_cast<std::uint32_t>(*c.output.format) : std::uint32_t{0});
+			write(c.output.level ? std::uint32_t{1} + static_cast<std::uint32_t>(*c.output.level) : std::uint32_t{0});
+			write(static_cast<std::uint32_t>(c.elements.size()));
+			for (auto const& element : c.elements) {
+				auto const kind = std::holds_alternative<text>(element.text_or_image) //
+					? deck_format::text_kind
+					: deck_format::image_kind;
+				write(kind);
+				write(std::uint32_t{element.is_static});
+				write(element.pos.x);
+				write(element.pos.y);
+				write(element.origin.x);
+				write(element.origin.y);
+				match(
+					element.text_or_image,
+					[&](text const& t) {
+						write(t.size);
+						write(static_cast<std::uint32_t>(t.markup.getSize()));
+						_fout.write(reinterpret_cast<char const*>(t.markup.getData()),
+							t.markup.getSize() * sizeof(sf::Uint32));
+					},
+					[&](image const& i) {
+						write(intern(i.path));
+						write(i.size.x);
+						write(i.size.y);
+						write(i.filter ? std::uint32_t{1} + static_cast<std::uint32_t>(*i.filter) : std::uint32_t{0});
+					});
+			}
+			++_card_count;
+		}
+
+		//! Writes the string table and header and closes the file.
+		//! @throw std::runtime_error if the file could not be written.
+		auto finish() -> void {
+			auto const string_table_offset = static_cast<std::uint64_t>(_fout.tellp()) / 4;
+			write(static_cast<std::uint32_t>(_strings.size()));
+			for (auto const& string : _strings) {
+				write(static_cast<std::uint32_t>(string.size()));
+				_fout.write(string.data(), string.size());
+				char const padding[4] = {};
+				_fout.write(padding, (4 - string.size() % 4) % 4);
+			}
+			_fout.seekp(sizeof(deck_format::magic));
+			write(deck_format::version);
+			write(_card_count);
+			write(static_cast<std::uint32_t>(string_table_offset));
+			write(static_cast<std::uint32_t>(string_table_offset >> 32));
+			_fout.close();
+			if (!_fout) { throw std::runtime_error{fmt::format("Could not write \"{}\".", _path)}; }
+		}
+
+	private:
+		std::string _path;
+		std::ofstream _fout;
+		std::uint32_t _card_count = 0;
+		std::vector<std::string> _strings;
+		std::unordered_map<std::string, std::uint32_t> _string_indices;
+
+		template <typename T>
+		auto write(T value) -> void {
+			static_assert(sizeof(T) == 4);
+			_fout.write(reinterpret_cast<char const*>(&value), sizeof(value));
+		}
+
+		auto intern(std::string const& string) -> std::uint32_t {
+			auto const result = _string_indices.try_emplace(string, static_cast<std::uint32_t>(_strings.size()));
+			if (result.second) { _strings.push_back(string); }
+			return result.first->second;
+		}
+	};
+
+	//! A memory-mapped binary deck file. Opening the file only indexes where each card starts; cards are decoded on
+	//! demand, with no text parsing.
+	struct deck_file {
+		//! @throw std::runtime_error if the file could not be mapped or is not a valid binary deck.
+		deck_file(std::string const& path) : _path{path}, _file{path} {
+			auto const words = _file.size() / 4;
+			if (_file.size() < 20 || _file.size() % 4 != 0 ||
+				std::memcmp(_file.data(), deck_format::magic, sizeof(deck_format::magic)) != 0) {
+				throw invalid();
+			}
+			if (word(1) != deck_format::version) {
+				throw std::runtime_error{fmt::format("Unsupported binary deck version {} in \"{}\".", word(1), path)};
+			}
+			auto const card_count = word(2);
+			auto const string_table = static_cast<std::size_t>(word(3) | std::uint64_t{word(4)} << 32);
+
+			// Index the string table.
+			if (string_table >= words) { throw invalid(); }
+			std::size_t offset = string_table + 1;
+			for (std::uint32_t i = 0; i < word(string_table); ++i) {
+				if (offset >= words) { throw invalid(); }
+				auto const length = word(offset);
+				auto const padded_words = (std::size_t{length} + 3) / 4;
+				if (offset + 1 + padded_words > words) { throw invalid(); }
+				_strings.push_back({bytes() + (offset + 1) * 4, length});
+				offset += 1 + padded_words;
+			}
+
+			// Index the cards.
+			offset = 5;
+			for (std::uint32_t i = 0; i < card_count; ++i) {
+				_cards.push_back(offset);
+				if (offset + 6 > string_table) { throw invalid(); }
+				auto const element_count = word(offset + 5);
+				offset += 6;
+				for (std::uint32_t e = 0; e < element_count; ++e) {
+					if (offset + 7 > string_table) { throw invalid(); }
+					auto const kind = word(offset);
+					if (kind != deck_format::text_kind && kind != deck_format::image_kind) { throw invalid(); }
+					offset += kind == deck_format::text_kind ? 8 + std::size_t{word(offset + 7)} : 10;
+				}
+				if (offset > string_table) { throw invalid(); }
+			}
+		}
+
+		//! The number of cards in the deck.
+		auto size() const -> std::size_t {
+			return _cards.size();
+		}
+
+		//! Decodes the card at @p index.
+		//! @throw std::runtime_error if the card's output format or an image's resample filter is not a valid value.
+		auto get(std::size_t index) const -> card {
+			auto offset = _cards.at(index);
+			auto const id_index = word(offset);
+			card result{sf::Vector2i{static_cast<int>(word(offset + 1)), static_cast<int>(word(offset + 2))}};
+			if (id_index != deck_format::no_string) { result.id = string(id_index); }
+			if (auto const format = word(offset + 3)) {
+				if (format - 1 > static_cast<std::uint32_t>(deck_format::last_image_format)) { throw invalid(); }
+				result.output.format = static_cast<image_format>(format - 1);
+			}
+			if (auto const level = word(offset + 4)) {
+				result.output.level = check_compression_level(static_cast<int>(level - 1));
+			}
+			auto const element_count = word(offset + 5);
+			offset += 6;
+			for (std::uint32_t e = 0; e < element_count; ++e) {
+				auto const kind = word(offset);
+				bool const is_static = word(offset + 1) != 0;
+				sf::Vector2f const pos{real(offset + 2), real(offset + 3)};
+				sf::Vector2f const origin{real(offset + 4), real(offset + 5)};
+				offset += 6;
+				// Opening the deck checked that each element is text or an image.
+				if (kind == deck_format::text_kind) {
+					auto const size = word(offset);
+					auto const length = word(offset + 1);
+					std::basic_string<sf::Uint32> markup(length, 0);
+					std::memcpy(markup.data(), bytes() + (offset + 2) * 4, std::size_t{length} * 4);
+					result.elements.push_back({text{sf::String{markup}, {}, size}, pos, origin, is_static});
+					offset += 2 + std::size_t{length};
+				} else {
+					image i{string(word(offset)), {real(offset + 1), real(offset + 2)}};
+					if (auto const filter = word(offset + 3)) {
+						if (filter - 1 > static_cast<std::uint32_t>(deck_format::last_resample_filter)) {
+							throw invalid();
+						}
+						i.filter = static_cast<resample_filter>(filter - 1);
+					}
+					result.elements.push_back({std::move(i), pos, origin, is_static});
+					offset += 4;
+				}
+			}
+			return result;
+		}
+
+	private:
+		struct string_ref {
+			char const* data;
+			std::size_t size;
+		};
+
+		std::string _path;
+		mapped_file _file;
+		std::vector<string_ref> _strings;
+		//! The word offset of each card.
+		std::vector<std::size_t> _cards;
+
+		auto bytes() const -> char const* {
+			return static_cast<char const*>(_file.data());
+		}
+
+		auto word(std::size_t offset) const -> std::uint32_t {
+			std::uint32_t result;
+			std::memcpy(&result, bytes() + offset * 4, 4);
+			return result;
+		}
+
+		auto real(std::size_t offset) const -> float {
+			float result;
+			std::memcpy(&result, bytes() + offset * 4, 4);
+			return result;
+		}
+
+		auto string(std::uint32_t index) const -> std::string {
+			auto const& ref = _strings.at(index);
+			return {ref.data, ref.size};
+		}
+
+		auto invalid() const -> std::runtime_error {
+			return std::runtime_error{fmt::format("\"{}\" is not a valid binary deck.", _path)};
+		}
+	};
+}
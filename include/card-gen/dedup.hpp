@@ -0,0 +1,57 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Deduplication: rendering identical cards once and linking their other outputs to the first.
+
+#pragma once
+
+#include "card-gen.hpp"
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cg {
+	//! Serializes everything that determines the pixels of @p c at @p scales: its canonical JSON without its ID, which
+	//! includes its size and output settings, followed by the bytes of the scales. Cards with equal keys render
+	//! identically.
+	inline auto render_key(card const& c, std::vector<float> const& scales = {}) -> std::string {
+		auto j = c.to_json();
+		j.erase("id");
+		auto result = j.dump();
+		for (auto const scale : scales) {
+			result.append(reinterpret_cast<char const*>(&scale), sizeof(scale));
+		}
+		return result;
+	}
+
+	//! Makes @p to a hard link to @p from, or a copy of it if they cannot be linked, e.g. because they are on
+	//! different volumes. Any existing file at @p to is replaced.
+	//! @return Whether @p to was created.
+	inline auto link_or_copy(std::string const& from, std::string const& to) -> bool {
+		if (from == to) { return true; }
+		std::error_code ec;
+		std::filesystem::remove(to, ec);
+		std::filesystem::create_hard_link(from, to, ec);
+		if (!ec) { return true; }
+		return std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing, ec);
+	}
+
+	//! Remembers the outputs of each distinct card rendered so far, so that identical cards, such as basic lands and
+	//! repeated printings, are rendered only once.
+	struct duplicate_tracker {
+		//! Looks for an earlier card that renders identically to @p c at @p scales.
+		//! @return The earlier card's output paths, or null if there is none, in which case @p output_paths are
+		//! recorded as the outputs of @p c.
+		auto find_or_add(card const& c, std::vector<float> const& scales, std::vector<std::string> output_paths)
+			-> std::vector<std::string> const* {
+			auto const [it, added] = _outputs.try_emplace(render_key(c, scales), std::move(output_paths));
+			return added ? nullptr : &it->second;
+		}
+
+	private:
+		//! Keyed by whole render keys rather than hashes of them, so that distinct cards are never taken for
+		//! duplicates.
+		std::unordered_map<std::string, std::vector<std::string>> _outputs;
+	};
+}
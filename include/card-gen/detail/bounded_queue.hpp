@@ -0,0 +1,78 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Blocking FIFO queue with a fixed capacity, for handing work between threads.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace cg {
+	template <typename T>
+	struct bounded_queue {
+		bounded_queue(std::size_t capacity) : _capacity{capacity} {}
+
+		//! Adds @p value to the back of the queue, blocking while the queue is full.
+		//! @return False, discarding @p value, if the queue is closed.
+		auto push(T value) -> bool {
+			{
+				std::unique_lock lock{_mutex};
+				_not_full.wait(lock, [this] { return _closed || _items.size() < _capacity; });
+				if (_closed) { return false; }
+				_items.push_back(std::move(value));
+			}
+			_not_empty.notify_one();
+			return true;
+		}
+
+		//! Removes the value at the front of the queue, blocking while the queue is empty and open.
+		//! @return The value, or nothing if the queue is closed and empty.
+		auto pop() -> std::optional<T> {
+			std::optional<T> result;
+			{
+				std::unique_lock lock{_mutex};
+				_not_empty.wait(lock, [this] { return _closed || !_items.empty(); });
+				if (_items.empty()) { return std::nullopt; }
+				result.emplace(std::move(_items.front()));
+				_items.pop_front();
+			}
+			_not_full.notify_one();
+			return result;
+		}
+
+		//! Removes the value at the front of the queue without blocking.
+		//! @return The value, or nothing if the queue is empty.
+		auto try_pop() -> std::optional<T> {
+			std::optional<T> result;
+			{
+				std::lock_guard lock{_mutex};
+				if (_items.empty()) { return std::nullopt; }
+				result.emplace(std::move(_items.front()));
+				_items.pop_front();
+			}
+			_not_full.notify_one();
+			return result;
+		}
+
+		//! Closes the queue. Values already queued can still be popped.
+		auto close() -> void {
+			{
+				std::lock_guard lock{_mutex};
+				_closed = true;
+			}
+			_not_empty.notify_all();
+			_not_full.notify_all();
+		}
+
+	private:
+		std::mutex _mutex;
+		std::condition_variable _not_empty;
+		std::condition_variable _not_full;
+		std::deque<T> _items;
+		std::size_t _capacity;
+		bool _closed = false;
+	};
+}
@@ -0,0 +1,71 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Minimal CSV reader.
+
+#pragma once
+
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace cg {
+	//! Reads all records from @p in. Fields are separated by commas and records by newlines. Fields may be quoted with
+	//! '"', in which case they may contain commas, newlines and doubled quotes. Carriage returns outside quotes are
+	//! ignored, and empty lines are skipped.
+	//! @throw std::domain_error if a quoted field is not terminated.
+	inline auto read_csv(std::istream& in) -> std::vector<std::vector<std::string>> {
+		std::vector<std::vector<std::string>> records;
+		std::vector<std::string> record;
+		std::string field;
+		bool quoted = false;
+		bool field_started = false;
+		auto const end_record = [&] {
+			if (field_started || !record.empty()) {
+				record.push_back(std::move(field));
+				records.push_back(std::move(record));
+			}
+			field.clear();
+			record.clear();
+			field_started = false;
+		};
+		for (char c; in.get(c);) {
+			if (quoted) {
+				if (c == '"') {
+					if (in.peek() == '"') {
+						in.get(c);
+						field += '"';
+					} else {
+						quoted = false;
+					}
+				} else {
+					field += c;
+				}
+				continue;
+			}
+			switch (c) {
+				case '"':
+					quoted = true;
+					field_started = true;
+					break;
+				case ',':
+					record.push_back(std::move(field));
+					field.clear();
+					field_started = true;
+					break;
+				case '\n':
+					end_record();
+					break;
+				case '\r':
+					break;
+				default:
+					field += c;
+					field_started = true;
+					break;
+			}
+		}
+		if (quoted) { throw std::domain_error{"Unterminated quoted field in CSV."}; }
+		end_record();
+		return records;
+	}
+}
@@ -0,0 +1,172 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+
+#include "font_cache.hpp"
+
+#include "profiler.hpp"
+
+#include <fmt/format.h>
+
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace cg {
+	namespace {
+		//! A thread's instance of a font, which keeps the font's file mapped.
+		struct thread_font {
+			std::shared_ptr<mapped_file const> file;
+			sf::Font font;
+			//! The registry's generation when this instance was last known to match the registry's file.
+			unsigned generation;
+			//! The number of the registry's glyph sets for this font that have been rasterized into this instance.
+			std::size_t prewarmed = 0;
+		};
+
+		//! Rasterizes @p glyphs into @p font's glyph pages.
+		auto rasterize(sf::Font& font, glyph_set const& glyphs) -> void {
+			for (auto const& style : glyphs.styles) {
+				for (auto const character : glyphs.characters) {
+					font.getGlyph(character, style.character_size, style.bold, style.outline_thickness);
+				}
+			}
+		}
+
+		//! Each thread's fonts, keyed by registry and path.
+		thread_local std::map<std::pair<font_cache const*, std::string>, thread_font> _thread_fonts;
+	}
+
+	auto font_cache::instance() -> font_cache& {
+		static font_cache result;
+		return result;
+	}
+
+	auto font_cache::preload(std::string const& path) -> void {
+		// Getting the font also validates it.
+		get(path);
+	}
+
+	auto font_cache::preload(std::vector<std::string> const& paths) -> void {
+		for (auto const& path : paths) {
+			preload(path);
+		}
+	}
+
+	auto font_cache::contains(std::string const& path) const -> bool {
+		std::shared_lock lock{_mutex};
+		return _files.find(path) != _files.end();
+	}
+
+	auto font_cache::prewarm(std::string const& path, glyph_set glyphs) -> void {
+		{
+			std::unique_lock lock{_mutex};
+			_glyph_sets[path].push_back(std::move(glyphs));
+		}
+		_generation.fetch_add(1, std::memory_order_release);
+		// Getting the font applies the new glyph set on this thread.
+		get(path);
+	}
+
+	auto font_cache::prewarm_thread() -> void {
+		std::vector<std::string> paths;
+		{
+			std::shared_lock lock{_mutex};
+			for (auto const& [path, glyph_sets] : _glyph_sets) {
+				paths.push_back(path);
+			}
+		}
+		for (auto const& path : paths) {
+			try {
+				get(path);
+			} catch (std::exception const&) {}
+		}
+	}
+
+	auto font_cache::get(std::string const& path) -> sf::Font& {
+		auto const generation = _generation.load(std::memory_order_acquire);
+		// First = (key, font) pair; second = whether insertion occurred.
+		auto result = _thread_fonts.try_emplace({this, path});
+		// Whether this instance needs checking for glyph sets to prewarm.
+		bool const is_stale = result.second || result.first->second.generation != generation;
+		if (!result.second && result.first->second.generation != generation) {
+			// Some font was erased or prewarmed since this instance was checked. Keep it only if its file is still
+			// registered.
+			auto& entry = result.first->second;
+			bool is_current;
+			{
+				std::shared_lock lock{_mutex};
+				auto const it = _files.find(path);
+				is_current = it != _files.end() && it->second == entry.file;
+			}
+			if (is_current) {
+				entry.generation = generation;
+			} else {
+				_thread_fonts.erase(result.first);
+				result = _thread_fonts.try_emplace({this, path});
+			}
+		}
+		if (result.second) {
+			// Cache miss. Need to load this thread's instance of the font.
+			count("font cache misses");
+			scoped_timer const timer{"load font"};
+			auto& entry = result.first->second;
+			try {
+				entry.file = get_file(path);
+			} catch (...) {
+				_thread_fonts.erase(result.first);
+				throw;
+			}
+			if (!entry.font.loadFromMemory(entry.file->data(), entry.file->size())) {
+				_thread_fonts.erase(result.first);
+				throw std::runtime_error{fmt::format("Could not load font from \"{}\".", path)};
+			}
+			entry.generation = generation;
+		} else {
+			count("font cache hits");
+		}
+		auto& entry = result.first->second;
+		if (is_stale) {
+			// Copy the glyph sets this instance lacks, and rasterize them outside the lock.
+			std::vector<glyph_set> pending;
+			{
+				std::shared_lock lock{_mutex};
+				auto const it = _glyph_sets.find(path);
+				if (it != _glyph_sets.end() && it->second.size() > entry.prewarmed) {
+					pending.assign(it->second.begin() + entry.prewarmed, it->second.end());
+				}
+			}
+			if (!pending.empty()) {
+				scoped_timer const timer{"prewarm glyphs"};
+				for (auto const& glyphs : pending) {
+					rasterize(entry.font, glyphs);
+				}
+				entry.prewarmed += pending.size();
+			}
+		}
+		return entry.font;
+	}
+
+	auto font_cache::erase(std::string const& path) -> void {
+		std::unique_lock lock{_mutex};
+		_files.erase(path);
+		_generation.fetch_add(1, std::memory_order_release);
+	}
+
+	auto font_cache::get_file(std::string const& path) -> std::shared_ptr<mapped_file const> {
+		{
+			std::shared_lock lock{_mutex};
+			auto const it = _files.find(path);
+			if (it != _files.end()) { return it->second; }
+		}
+		// Map the file outside the lock. If another thread maps it concurrently, the first insertion wins.
+		std::shared_ptr<mapped_file const> file;
+		try {
+			file = std::make_shared<mapped_file const>(path);
+		} catch (std::runtime_error const&) {
+			throw std::runtime_error{fmt::format("Could not load font from \"{}\".", path)};
+		}
+		std::unique_lock lock{_mutex};
+		return _files.try_emplace(path, std::move(file)).first->second;
+	}
+}
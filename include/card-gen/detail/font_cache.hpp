@@ -0,0 +1,108 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Thread-safe registry of fonts, keyed by path.
+
+#pragma once
+
+#include "mapped_file.hpp"
+
+#include <SFML/Graphics/Font.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+namespace cg {
+	//! A way a glyph can be rasterized: at a character size, regular or bold, and with or without an outline.
+	struct glyph_style {
+		unsigned character_size;
+		bool bold = false;
+		float outline_thickness = 0;
+
+		auto operator==(glyph_style const& that) const -> bool {
+			return character_size == that.character_size && bold == that.bold &&
+				outline_thickness == that.outline_thickness;
+		}
+	};
+
+	//! Glyphs to rasterize ahead of use: each character in each style.
+	struct glyph_set {
+		std::vector<glyph_style> styles;
+		std::set<sf::Uint32> characters;
+
+		//! Adds @p style, if not already present.
+		auto add_style(glyph_style style) -> void {
+			if (std::find(styles.begin(), styles.end(), style) == styles.end()) { styles.push_back(style); }
+		}
+	};
+
+	//! Registry of fonts by path. Each font file is memory-mapped, or copied in mapped_file::mode::copy, once per
+	//! process and shared by all threads, and processes on the same host share a mapped file's pages. Since sf::Font
+	//! rasterizes glyphs lazily and is not thread-safe, each thread gets its own sf::Font over the shared mapping.
+	struct font_cache {
+		//! The process-wide font registry used by rich text.
+		static auto instance() -> font_cache&;
+
+		font_cache() = default;
+
+		font_cache(font_cache const&) = delete;
+		auto operator=(font_cache const&) -> font_cache& = delete;
+
+		//! Loads the font at @p path ahead of use, if it is not already loaded.
+		//! @throw std::runtime_error if the font could not be loaded.
+		auto preload(std::string const& path) -> void;
+
+		//! Loads each font in @p paths ahead of use.
+		//! @throw std::runtime_error if a font could not be loaded.
+		auto preload(std::vector<std::string> const& paths) -> void;
+
+		//! Rasterizes @p glyphs of the font at @p path into the font's glyph pages ahead of use, so that laying out
+		//! text does not stall on rasterization or grow the page textures. The calling thread's instance of the font
+		//! is prewarmed immediately, and every other thread's instance on that thread's next use of the font,
+		//! including instances loaded later or reloaded after erase, unless it calls prewarm_thread first.
+		//! @throw std::runtime_error if the font could not be loaded.
+		auto prewarm(std::string const& path, glyph_set glyphs) -> void;
+
+		//! Loads the calling thread's instance of each prewarmed font and rasterizes its glyph sets, so that a thread
+		//! about to render does so before its first card rather than during it. Fonts that fail to load are skipped;
+		//! using them reports the error.
+		auto prewarm_thread() -> void;
+
+		//! Whether the font at @p path has been loaded.
+		auto contains(std::string const& path) const -> bool;
+
+		//! Gets the calling thread's instance of the font at @p path, loading the font on first use.
+		//! @note The font remains valid until the calling thread exits.
+		//! @throw std::runtime_error if the font could not be loaded.
+		auto get(std::string const& path) -> sf::Font&;
+
+		//! Gets the mapping of the font file at @p path, shared by all threads, mapping it on first use.
+		//! @throw std::runtime_error if the file could not be mapped.
+		auto get_file(std::string const& path) -> std::shared_ptr<mapped_file const>;
+
+		//! Forgets the font at @p path, so that it is loaded again from disk on next use, e.g. after the file changes.
+		//! @note Each thread's previous instance of the font is destroyed on that thread's next call to get for
+		//! @p path, so text laid out with it must not be drawn afterward.
+		auto erase(std::string const& path) -> void;
+
+		//! A number that changes whenever a font is erased or prewarmed, so that holders of text laid out with the
+		//! registry's fonts can tell when to lay it out again.
+		auto get_generation() const -> unsigned {
+			return _generation.load(std::memory_order_acquire);
+		}
+
+	private:
+		mutable std::shared_mutex _mutex;
+		std::map<std::string, std::shared_ptr<mapped_file const>> _files;
+		//! The glyph sets to prewarm each font with, in the order they were added.
+		std::map<std::string, std::vector<glyph_set>> _glyph_sets;
+		//! Incremented by each erase or prewarm, so each thread can tell when to check its fonts against the
+		//! registry.
+		std::atomic<unsigned> _generation{0};
+	};
+}
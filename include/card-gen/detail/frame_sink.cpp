@@ -0,0 +1,67 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+
+#include "frame_sink.hpp"
+
+#include "profiler.hpp"
+
+#include <fmt/format.h>
+
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace cg {
+	namespace {
+		auto put_little_endian(std::vector<std::uint8_t>& out, std::uint32_t value) -> void {
+			for (int shift = 0; shift < 32; shift += 8) {
+				out.push_back(static_cast<std::uint8_t>(value >> shift));
+			}
+		}
+	}
+
+	frame_sink::frame_sink(std::string const& path) : _file{nullptr}, _owned{path != "-"} {
+		if (!_owned) {
+#ifdef _WIN32
+			// Keep newline translation from corrupting pixels.
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			_file = stdout;
+			return;
+		}
+		_file = std::fopen(path.c_str(), "wb");
+		if (!_file) { throw std::runtime_error{fmt::format("Could not open \"{}\" for writing frames.", path)}; }
+	}
+
+	frame_sink::~frame_sink() {
+		if (_owned) {
+			std::fclose(_file);
+		} else {
+			std::fflush(_file);
+		}
+	}
+
+	auto frame_sink::write(sf::Image const& image, std::string const& name) -> bool {
+		scoped_timer const timer{"write frame"};
+		auto const size = image.getSize();
+		std::vector<std::uint8_t> header(frame_format::magic, frame_format::magic + sizeof(frame_format::magic));
+		put_little_endian(header, frame_format::version);
+		put_little_endian(header, size.x);
+		put_little_endian(header, size.y);
+		put_little_endian(header, static_cast<std::uint32_t>(name.size()));
+		header.insert(header.end(), name.begin(), name.end());
+		std::size_t const pixel_bytes = std::size_t{4} * size.x * size.y;
+
+		// The pixels are written straight from the image, without an intermediate copy.
+		std::lock_guard lock{_mutex};
+		bool const written = std::fwrite(header.data(), 1, header.size(), _file) == header.size()
+			&& (pixel_bytes == 0 || std::fwrite(image.getPixelsPtr(), 1, pixel_bytes, _file) == pixel_bytes)
+			&& std::fflush(_file) == 0;
+		if (written) { count("bytes written", header.size() + pixel_bytes); }
+		return written;
+	}
+}
@@ -0,0 +1,46 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Streaming of raw rendered frames to standard output or a pipe, for consumers that skip encoding.
+
+#pragma once
+
+#include <SFML/Graphics/Image.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+namespace cg {
+	//! Layout of a raw frame. All fields are 4-byte little-endian unsigned integers.
+	//!
+	//! - Header: magic "CGRF", version, width, height, name byte length, then the name's UTF-8 bytes;
+	//! - Pixels: width * height RGBA pixels, 8 bits per channel, row by row from the top, with no padding.
+	//!
+	//! Frames are written back to back, so a stream of them can be read without any other framing.
+	namespace frame_format {
+		constexpr char magic[4] = {'C', 'G', 'R', 'F'};
+		constexpr std::uint32_t version = 1;
+	}
+
+	//! Writes rendered images as raw frames to a stream, whole frame by whole frame, from any number of threads.
+	struct frame_sink {
+		//! Opens @p path for writing, which may be a named pipe. "-" is standard output.
+		//! @throw std::runtime_error if @p path could not be opened.
+		frame_sink(std::string const& path);
+		//! Flushes and closes the stream, unless it is standard output.
+		~frame_sink();
+
+		frame_sink(frame_sink const&) = delete;
+		auto operator=(frame_sink const&) -> frame_sink& = delete;
+
+		//! Writes @p image as a frame named @p name and flushes it, so a consumer can read it right away.
+		//! @return Whether the frame was written successfully.
+		auto write(sf::Image const& image, std::string const& name) -> bool;
+
+	private:
+		std::FILE* _file;
+		bool _owned;
+		std::mutex _mutex;
+	};
+}
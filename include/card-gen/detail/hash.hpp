@@ -0,0 +1,42 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Stable, non-cryptographic hashing.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace cg {
+	//! Incremental 64-bit FNV-1a hash. Unlike std::hash, the result is the same across runs, builds and platforms, so
+	//! it may be stored.
+	struct fnv1a {
+		auto add(void const* data, std::size_t size) -> fnv1a& {
+			auto const bytes = static_cast<unsigned char const*>(data);
+			for (std::size_t i = 0; i < size; ++i) {
+				_value = (_value ^ bytes[i]) * 0x100000001b3;
+			}
+			return *this;
+		}
+
+		auto add(std::string_view bytes) -> fnv1a& {
+			return add(bytes.data(), bytes.size());
+		}
+
+		auto add(std::uint64_t value) -> fnv1a& {
+			for (int i = 0; i < 8; ++i) {
+				unsigned char const byte = static_cast<unsigned char>(value >> 8 * i);
+				add(&byte, 1);
+			}
+			return *this;
+		}
+
+		auto get() const -> std::uint64_t {
+			return _value;
+		}
+
+	private:
+		std::uint64_t _value = 0xcbf29ce484222325;
+	};
+}
@@ -0,0 +1,665 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+
+#include "image_encoder.hpp"
+
+#include "profiler.hpp"
+#include "worker_pool.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+
+namespace cg {
+	namespace {
+		std::atomic<int> _default_compression_level{6};
+		//! Threads that encoders may borrow to deflate segments of an image in parallel. Encoders share them, so that
+		//! however many encode at once, at most one thread per core deflates.
+		std::atomic<int> _spare_deflate_threads{static_cast<int>(std::thread::hardware_concurrency()) - 1};
+
+		//! Borrows up to @p wanted spare deflate threads for the lifetime of the lease.
+		struct deflate_thread_lease {
+			int count = 0;
+
+			deflate_thread_lease(int wanted) {
+				auto spare = _spare_deflate_threads.load();
+				do {
+					count = std::clamp(spare, 0, wanted);
+				} while (count > 0 && !_spare_deflate_threads.compare_exchange_weak(spare, spare - count));
+			}
+
+			deflate_thread_lease(deflate_thread_lease const&) = delete;
+			auto operator=(deflate_thread_lease const&) -> deflate_thread_lease& = delete;
+
+			~deflate_thread_lease() {
+				_spare_deflate_threads += count;
+			}
+		};
+
+		//! Writes bits least significant first, as deflate does.
+		struct bit_writer {
+			std::vector<std::uint8_t>& out;
+			std::uint64_t bits = 0;
+			unsigned count = 0;
+
+			auto put(std::uint32_t value, unsigned bit_count) -> void {
+				bits |= std::uint64_t{value} << count;
+				count += bit_count;
+				while (count >= 8) {
+					out.push_back(static_cast<std::uint8_t>(bits));
+					bits >>= 8;
+					count -= 8;
+				}
+			}
+
+			//! Pads with zero bits to a byte boundary.
+			auto align() -> void {
+				if (count > 0) { put(0, 8 - count); }
+			}
+		};
+
+		//! Deflate's length and distance codes: the first value of each code and its number of extra bits.
+		constexpr std::array<std::uint16_t, 29> length_base{3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35,
+			43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+		constexpr std::array<std::uint8_t, 29> length_extra{
+			0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+		constexpr std::array<std::uint16_t, 30> distance_base{1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+			257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+		constexpr std::array<std::uint8_t, 30> distance_extra{
+			0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+		//! The order in which code length code lengths are written.
+		constexpr std::array<std::uint8_t, 19> code_length_order{
+			16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+		constexpr std::size_t window_size = 32768;
+		constexpr unsigned min_match = 3;
+		constexpr unsigned max_match = 258;
+
+		//! A literal byte (distance 0) or a back-reference.
+		struct token {
+			std::uint16_t value;
+			std::uint16_t distance;
+		};
+
+		//! The index of the code whose range contains @p value.
+		template <std::size_t N>
+		auto find_code(std::array<std::uint16_t, N> const& base, unsigned value) -> unsigned {
+			return static_cast<unsigned>(std::upper_bound(base.begin(), base.end(), value) - base.begin() - 1);
+		}
+
+		//! Huffman code lengths for @p frequencies, limited to @p max_length bits. At least two symbols get codes, as
+		//! some decoders require.
+		auto get_code_lengths(std::vector<std::uint32_t> frequencies, unsigned max_length)
+			-> std::vector<std::uint8_t> {
+			auto const n = frequencies.size();
+			std::vector<std::uint8_t> result(n, 0);
+			for (std::size_t i = 0, used = 0; i < n && used < 2; ++i) {
+				if (frequencies[i] > 0) {
+					++used;
+				} else if (std::count_if(frequencies.begin(), frequencies.end(), [](auto f) { return f > 0; }) < 2) {
+					frequencies[i] = 1;
+					++used;
+				}
+			}
+
+			// Build the tree bottom-up, merging the two least frequent nodes.
+			std::vector<std::size_t> parent(2 * n, 0);
+			using node = std::pair<std::uint64_t, std::size_t>;
+			std::priority_queue<node, std::vector<node>, std::greater<node>> queue;
+			for (std::size_t i = 0; i < n; ++i) {
+				if (frequencies[i] > 0) { queue.push({frequencies[i], i}); }
+			}
+			auto next = n;
+			while (queue.size() > 1) {
+				auto const a = queue.top();
+				queue.pop();
+				auto const b = queue.top();
+				queue.pop();
+				parent[a.second] = parent[b.second] = next;
+				queue.push({a.first + b.first, next++});
+			}
+			auto const root = next - 1;
+			std::vector<std::size_t> depth(2 * n, 0);
+			for (auto i = root; i-- > n;) {
+				depth[i] = depth[parent[i]] + 1;
+			}
+
+			// Count the codes of each length. The tree is full, so the code is complete.
+			std::vector<std::size_t> symbols;
+			std::vector<std::size_t> length_counts(std::max<std::size_t>(root - n + 2, max_length + 1), 0);
+			for (std::size_t i = 0; i < n; ++i) {
+				if (frequencies[i] == 0) { continue; }
+				symbols.push_back(i);
+				++length_counts[depth[parent[i]] + 1];
+			}
+
+			// Limit the lengths while keeping the code complete, which inflaters such as zlib require (ITU-T T.81,
+			// K.3): two codes of an overlong length are replaced by one a bit shorter, and the freed space is filled by
+			// splitting the longest code that is at least two bits shorter into two codes one bit longer. A complete
+			// code always has an even number of codes of its longest length, so each pass empties that length.
+			for (auto length = length_counts.size() - 1; length > max_length; --length) {
+				while (length_counts[length] > 0) {
+					auto shorter = length - 2;
+					while (length_counts[shorter] == 0) {
+						--shorter;
+					}
+					length_counts[length] -= 2;
+					++length_counts[length - 1];
+					length_counts[shorter + 1] += 2;
+					--length_counts[shorter];
+				}
+			}
+
+			// Give the shortest codes to the most frequent symbols.
+			std::stable_sort(symbols.begin(), symbols.end(), [&](std::size_t a, std::size_t b) {
+				return frequencies[a] > frequencies[b];
+			});
+			auto symbol = symbols.begin();
+			for (unsigned length = 1; length <= max_length; ++length) {
+				for (std::size_t i = 0; i < length_counts[length]; ++i) {
+					result[*symbol++] = static_cast<std::uint8_t>(length);
+				}
+			}
+			return result;
+		}
+
+		//! Canonical Huffman codes for @p lengths, bit-reversed for writing least significant bit first.
+		auto get_codes(std::vector<std::uint8_t> const& lengths) -> std::vector<std::uint16_t> {
+			std::array<std::uint16_t, 16> length_counts{};
+			for (auto const length : lengths) {
+				if (length > 0) { ++length_counts[length]; }
+			}
+			std::array<std::uint16_t, 16> next_code{};
+			for (unsigned length = 1, code = 0; length < 16; ++length) {
+				code = (code + length_counts[length - 1u]) << 1;
+				next_code[length] = static_cast<std::uint16_t>(code);
+			}
+			std::vector<std::uint16_t> result(lengths.size(), 0);
+			for (std::size_t i = 0; i < lengths.size(); ++i) {
+				if (lengths[i] == 0) { continue; }
+				unsigned code = next_code[lengths[i]]++;
+				unsigned reversed = 0;
+				for (unsigned bit = 0; bit < lengths[i]; ++bit) {
+					reversed = reversed << 1 | (code >> bit & 1);
+				}
+				result[i] = static_cast<std::uint16_t>(reversed);
+			}
+			return result;
+		}
+
+		//! Writes @p tokens as one deflate block with dynamic Huffman codes.
+		auto write_block(bit_writer& out, std::vector<token> const& tokens, bool is_final) -> void {
+			std::vector<std::uint32_t> literal_frequencies(286, 0);
+			std::vector<std::uint32_t> distance_frequencies(30, 0);
+			for (auto const& t : tokens) {
+				if (t.distance == 0) {
+					++literal_frequencies[t.value];
+				} else {
+					++literal_frequencies[257 + find_code(length_base, t.value)];
+					++distance_frequencies[find_code(distance_base, t.distance)];
+				}
+			}
+			++literal_frequencies[256];
+			auto const literal_lengths = get_code_lengths(literal_frequencies, 15);
+			auto const distance_lengths = get_code_lengths(distance_frequencies, 15);
+			auto const literal_codes = get_codes(literal_lengths);
+			auto const distance_codes = get_codes(distance_lengths);
+
+			std::size_t literal_count = 286;
+			while (literal_count > 257 && literal_lengths[literal_count - 1] == 0) {
+				--literal_count;
+			}
+			std::size_t distance_count = 30;
+			while (distance_count > 1 && distance_lengths[distance_count - 1] == 0) {
+				--distance_count;
+			}
+
+			// Run-length encode the code lengths: (symbol, extra bits value).
+			std::vector<std::uint8_t> lengths(literal_lengths.begin(), literal_lengths.begin() + literal_count);
+			lengths.insert(lengths.end(), distance_lengths.begin(), distance_lengths.begin() + distance_count);
+			std::vector<std::pair<std::uint8_t, std::uint8_t>> runs;
+			for (std::size_t i = 0; i < lengths.size();) {
+				auto run = std::size_t{1};
+				while (i + run < lengths.size() && lengths[i + run] == lengths[i]) {
+					++run;
+				}
+				if (lengths[i] == 0 && run >= 3) {
+					run = std::min<std::size_t>(run, 138);
+					runs.emplace_back(run >= 11 ? 18 : 17, static_cast<std::uint8_t>(run >= 11 ? run - 11 : run - 3));
+				} else if (run >= 4) {
+					runs.emplace_back(lengths[i], 0);
+					run = std::min<std::size_t>(run - 1, 6);
+					runs.emplace_back(16, static_cast<std::uint8_t>(run - 3));
+					++run;
+				} else {
+					run = 1;
+					runs.emplace_back(lengths[i], 0);
+				}
+				i += run;
+			}
+			std::vector<std::uint32_t> code_length_frequencies(19, 0);
+			for (auto const& run : runs) {
+				++code_length_frequencies[run.first];
+			}
+			auto const code_length_lengths = get_code_lengths(code_length_frequencies, 7);
+			auto const code_length_codes = get_codes(code_length_lengths);
+			std::size_t code_length_count = 19;
+			while (code_length_count > 4 && code_length_lengths[code_length_order[code_length_count - 1]] == 0) {
+				--code_length_count;
+			}
+
+			out.put(is_final, 1);
+			out.put(2, 2);
+			out.put(static_cast<std::uint32_t>(literal_count - 257), 5);
+			out.put(static_cast<std::uint32_t>(distance_count - 1), 5);
+			out.put(static_cast<std::uint32_t>(code_length_count - 4), 4);
+			for (std::size_t i = 0; i < code_length_count; ++i) {
+				out.put(code_length_lengths[code_length_order[i]], 3);
+			}
+			for (auto const& [symbol, extra] : runs) {
+				out.put(code_length_codes[symbol], code_length_lengths[symbol]);
+				if (symbol == 16) { out.put(extra, 2); }
+				if (symbol == 17) { out.put(extra, 3); }
+				if (symbol == 18) { out.put(extra, 7); }
+			}
+
+			for (auto const& t : tokens) {
+				if (t.distance == 0) {
+					out.put(literal_codes[t.value], literal_lengths[t.value]);
+					continue;
+				}
+				auto const length_code = find_code(length_base, t.value);
+				out.put(literal_codes[257 + length_code], literal_lengths[257 + length_code]);
+				out.put(t.value - length_base[length_code], length_extra[length_code]);
+				auto const distance_code = find_code(distance_base, t.distance);
+				out.put(distance_codes[distance_code], distance_lengths[distance_code]);
+				out.put(t.distance - distance_base[distance_code], distance_extra[distance_code]);
+			}
+			out.put(literal_codes[256], literal_lengths[256]);
+		}
+
+		//! Deflates @p size bytes at @p data as raw deflate blocks. Unless @p is_last, the output ends with an empty
+		//! stored block, so that it is byte-aligned and can be followed by independently deflated data.
+		auto deflate(std::uint8_t const* data, std::size_t size, int level, bool is_last) -> std::vector<std::uint8_t> {
+			std::vector<std::uint8_t> result;
+			bit_writer out{result};
+			if (level == 0) {
+				// Stored blocks of at most 65535 bytes.
+				std::size_t offset = 0;
+				do {
+					auto const block_size = static_cast<std::uint32_t>(std::min<std::size_t>(size - offset, 65535));
+					offset += block_size;
+					out.put(is_last && offset == size, 1);
+					out.put(0, 2);
+					out.align();
+					out.put(block_size, 16);
+					out.put(~block_size & 0xffff, 16);
+					result.insert(result.end(), data + offset - block_size, data + offset);
+				} while (offset < size);
+				return result;
+			}
+
+			// Greedy LZ77 over hash chains of three-byte prefixes; higher levels search longer chains.
+			constexpr std::array<unsigned, max_compression_level + 1> chain_lengths{
+				0, 1, 2, 4, 8, 16, 32, 64, 128, 512};
+			constexpr std::array<unsigned, max_compression_level + 1> nice_lengths{
+				0, 8, 16, 32, 64, 128, 258, 258, 258, 258};
+			auto const max_chain = chain_lengths[level];
+			auto const nice_length = nice_lengths[level];
+			// Low levels only index the start of each match, skipping the positions it covers.
+			bool const index_all = level >= 4;
+
+			constexpr std::size_t hash_bits = 15;
+			std::vector<std::int32_t> head(std::size_t{1} << hash_bits, -1);
+			std::vector<std::int32_t> prev(window_size, -1);
+			auto const hash = [&](std::size_t i) {
+				auto const v = std::uint32_t{data[i]} | std::uint32_t{data[i + 1]} << 8 //
+					| std::uint32_t{data[i + 2]} << 16;
+				return (v * 2654435761u) >> (32 - hash_bits);
+			};
+			auto const insert = [&](std::size_t i) {
+				if (i + min_match > size) { return; }
+				auto& h = head[hash(i)];
+				prev[i % window_size] = h;
+				h = static_cast<std::int32_t>(i);
+			};
+
+			std::vector<token> tokens;
+			// Each block holds up to this many tokens, so its codes adapt to the data's statistics.
+			constexpr std::size_t block_tokens = 1 << 16;
+			tokens.reserve(block_tokens);
+			for (std::size_t i = 0; i < size;) {
+				unsigned best_length = 0;
+				std::size_t best_distance = 0;
+				if (i + min_match <= size) {
+					auto const max_length = static_cast<unsigned>(std::min<std::size_t>(max_match, size - i));
+					auto candidate = head[hash(i)];
+					for (unsigned chain = 0; candidate >= 0 && chain < max_chain; ++chain) {
+						auto const c = static_cast<std::size_t>(candidate);
+						if (i - c > window_size - 1) { break; }
+						if (data[c + best_length] == data[i + best_length]) {
+							unsigned length = 0;
+							while (length < max_length && data[c + length] == data[i + length]) {
+								++length;
+							}
+							if (length > best_length) {
+								best_length = length;
+								best_distance = i - c;
+								if (length >= nice_length || length == max_length) { break; }
+							}
+						}
+						auto const next = prev[c % window_size];
+						if (next >= candidate) { break; }
+						candidate = next;
+					}
+				}
+				if (best_length >= min_match) {
+					tokens.push_back(
+						{static_cast<std::uint16_t>(best_length), static_cast<std::uint16_t>(best_distance)});
+					if (index_all) {
+						for (std::size_t j = i; j < i + best_length; ++j) {
+							insert(j);
+						}
+					} else {
+						insert(i);
+					}
+					i += best_length;
+				} else {
+					tokens.push_back({data[i], 0});
+					insert(i);
+					++i;
+				}
+				if (tokens.size() == block_tokens && i < size) {
+					write_block(out, tokens, false);
+					tokens.clear();
+				}
+			}
+			write_block(out, tokens, is_last);
+			if (!is_last) {
+				// An empty stored block ends the data on a byte boundary.
+				out.put(0, 3);
+				out.align();
+				out.put(0, 16);
+				out.put(0xffff, 16);
+			}
+			out.align();
+			return result;
+		}
+
+		auto adler32(std::uint8_t const* data, std::size_t size) -> std::uint32_t {
+			std::uint32_t a = 1;
+			std::uint32_t b = 0;
+			while (size > 0) {
+				// The sums cannot overflow within 5552 bytes.
+				auto const chunk = std::min<std::size_t>(size, 5552);
+				for (std::size_t i = 0; i < chunk; ++i) {
+					a += data[i];
+					b += a;
+				}
+				a %= 65521;
+				b %= 65521;
+				data += chunk;
+				size -= chunk;
+			}
+			return b << 16 | a;
+		}
+
+		auto crc32(std::uint8_t const* data, std::size_t size, std::uint32_t crc = 0) -> std::uint32_t {
+			static auto const table = [] {
+				std::array<std::uint32_t, 256> result{};
+				for (std::uint32_t n = 0; n < 256; ++n) {
+					auto c = n;
+					for (int k = 0; k < 8; ++k) {
+						c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+					}
+					result[n] = c;
+				}
+				return result;
+			}();
+			crc = ~crc;
+			for (std::size_t i = 0; i < size; ++i) {
+				crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+			}
+			return ~crc;
+		}
+
+		auto put_big_endian(std::vector<std::uint8_t>& out, std::uint32_t value) -> void {
+			for (int shift = 24; shift >= 0; shift -= 8) {
+				out.push_back(static_cast<std::uint8_t>(value >> shift));
+			}
+		}
+
+		auto write_chunk(std::vector<std::uint8_t>& out, char const (&type)[5], std::vector<std::uint8_t> const& data)
+			-> void {
+			put_big_endian(out, static_cast<std::uint32_t>(data.size()));
+			auto const type_begin = out.size();
+			out.insert(out.end(), type, type + 4);
+			out.insert(out.end(), data.begin(), data.end());
+			put_big_endian(out, crc32(out.data() + type_begin, out.size() - type_begin));
+		}
+
+		auto paeth(int a, int b, int c) -> int {
+			auto const p = a + b - c;
+			auto const pa = std::abs(p - a);
+			auto const pb = std::abs(p - b);
+			auto const pc = std::abs(p - c);
+			return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+		}
+
+		//! Applies PNG filter @p type to @p row, given the previous row @p above (null for the first row), writing
+		//! @p row_size bytes to @p out.
+		auto filter_row(std::uint8_t type,
+			std::uint8_t const* row,
+			std::uint8_t const* above,
+			std::size_t row_size,
+			std::uint8_t* out) -> void {
+			constexpr std::size_t bpp = 4;
+			for (std::size_t i = 0; i < row_size; ++i) {
+				int const a = i >= bpp ? row[i - bpp] : 0;
+				int const b = above ? above[i] : 0;
+				int const c = above && i >= bpp ? above[i - bpp] : 0;
+				int predictor = 0;
+				switch (type) {
+					case 1: predictor = a; break;
+					case 2: predictor = b; break;
+					case 3: predictor = (a + b) / 2; break;
+					case 4: predictor = paeth(a, b, c); break;
+				}
+				out[i] = static_cast<std::uint8_t>(row[i] - predictor);
+			}
+		}
+	}
+
+	auto parse_image_format(std::string const& name) -> image_format {
+		if (name == "png") { return image_format::png; }
+		if (name == "qoi") { return image_format::qoi; }
+		throw std::domain_error{fmt::format("Unknown image format \"{}\"; expected \"png\" or \"qoi\".", name)};
+	}
+
+	auto to_string(image_format format) -> std::string {
+		switch (format) {
+			case image_format::png: return "png";
+			case image_format::qoi: return "qoi";
+		}
+		return {};
+	}
+
+	auto get_extension(image_format format) -> std::string {
+		return "." + to_string(format);
+	}
+
+	auto get_format(std::string const& path) -> std::optional<image_format> {
+		auto extension = std::filesystem::path{path}.extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) {
+			return static_cast<char>(std::tolower(c));
+		});
+		if (extension == ".png") { return image_format::png; }
+		if (extension == ".qoi") { return image_format::qoi; }
+		return std::nullopt;
+	}
+
+	auto check_compression_level(int level) -> int {
+		if (level < 0 || level > max_compression_level) {
+			throw std::domain_error{
+				fmt::format("Invalid compression level {}; expected 0 to {}.", level, max_compression_level)};
+		}
+		return level;
+	}
+
+	auto get_default_compression_level() -> int {
+		return _default_compression_level.load(std::memory_order_relaxed);
+	}
+
+	auto set_default_compression_level(int level) -> void {
+		_default_compression_level.store(check_compression_level(level), std::memory_order_relaxed);
+	}
+
+	auto encode_png(sf::Image const& image, int level) -> std::vector<std::uint8_t> {
+		scoped_timer const timer{"encode png"};
+		check_compression_level(level);
+		auto const size = image.getSize();
+		if (size.x == 0 || size.y == 0) { throw std::domain_error{"Cannot encode an empty image as PNG."}; }
+		auto const pixels = image.getPixelsPtr();
+		std::size_t const row_size = std::size_t{4} * size.x;
+
+		// Filter each row, prefixed by its filter type.
+		std::vector<std::uint8_t> filtered((row_size + 1) * size.y);
+		std::vector<std::uint8_t> candidate(row_size);
+		for (std::size_t y = 0; y < size.y; ++y) {
+			auto const row = pixels + y * row_size;
+			auto const above = y > 0 ? row - row_size : nullptr;
+			auto const out = filtered.data() + y * (row_size + 1);
+			if (level < 4) {
+				// Up filtering suits the smooth vertical gradients and flat fills typical of cards.
+				out[0] = level == 0 ? 0 : 2;
+				filter_row(out[0], row, above, row_size, out + 1);
+				continue;
+			}
+			// Choose the filter with the smallest sum of absolute values, a cheap estimate of compressibility.
+			std::uint64_t best_cost = ~std::uint64_t{0};
+			for (std::uint8_t type = 0; type < 5; ++type) {
+				filter_row(type, row, above, row_size, candidate.data());
+				std::uint64_t cost = 0;
+				for (auto const value : candidate) {
+					cost += static_cast<std::uint64_t>(std::abs(static_cast<std::int8_t>(value)));
+				}
+				if (cost < best_cost) {
+					best_cost = cost;
+					out[0] = type;
+					std::copy(candidate.begin(), candidate.end(), out + 1);
+				}
+			}
+		}
+
+		// Deflate large images in independent segments, in parallel where threads are spare, joined on byte boundaries.
+		constexpr std::size_t segment_size = std::size_t{1} << 20;
+		auto const segment_count = level == 0 ? 1 : std::max<std::size_t>(1, filtered.size() / segment_size);
+		std::vector<std::vector<std::uint8_t>> segments(segment_count);
+		// The encoding thread deflates too, helped by any spare threads.
+		deflate_thread_lease const helpers{static_cast<int>(segment_count) - 1};
+		parallel_for(segment_count, static_cast<unsigned>(1 + helpers.count), [&](std::size_t i) {
+			auto const begin = i * filtered.size() / segment_count;
+			auto const end = (i + 1) * filtered.size() / segment_count;
+			segments[i] = deflate(filtered.data() + begin, end - begin, level, i + 1 == segment_count);
+		});
+
+		// The zlib header's level hint: fastest, fast, default or maximum compression.
+		auto const level_hint = level <= 1 ? 0x01 : level <= 5 ? 0x5e : level == 6 ? 0x9c : 0xda;
+		std::vector<std::uint8_t> idat{0x78, static_cast<std::uint8_t>(level_hint)};
+		for (auto const& segment : segments) {
+			idat.insert(idat.end(), segment.begin(), segment.end());
+		}
+		put_big_endian(idat, adler32(filtered.data(), filtered.size()));
+
+		std::vector<std::uint8_t> result{0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+		std::vector<std::uint8_t> ihdr;
+		put_big_endian(ihdr, size.x);
+		put_big_endian(ihdr, size.y);
+		// 8-bit RGBA, deflate, adaptive filtering, no interlacing.
+		ihdr.insert(ihdr.end(), {8, 6, 0, 0, 0});
+		write_chunk(result, "IHDR", ihdr);
+		write_chunk(result, "IDAT", idat);
+		write_chunk(result, "IEND", {});
+		return result;
+	}
+
+	auto encode_qoi(sf::Image const& image) -> std::vector<std::uint8_t> {
+		scoped_timer const timer{"encode qoi"};
+		auto const size = image.getSize();
+		auto const pixels = image.getPixelsPtr();
+		std::size_t const pixel_count = std::size_t{size.x} * size.y;
+
+		std::vector<std::uint8_t> result{'q', 'o', 'i', 'f'};
+		result.reserve(14 + pixel_count * 5 + 8);
+		put_big_endian(result, size.x);
+		put_big_endian(result, size.y);
+		// RGBA, sRGB with linear alpha.
+		result.insert(result.end(), {4, 0});
+
+		std::array<std::array<std::uint8_t, 4>, 64> seen{};
+		std::array<std::uint8_t, 4> previous{0, 0, 0, 255};
+		unsigned run = 0;
+		for (std::size_t i = 0; i < pixel_count; ++i) {
+			std::array<std::uint8_t, 4> const pixel{
+				pixels[4 * i], pixels[4 * i + 1], pixels[4 * i + 2], pixels[4 * i + 3]};
+			if (pixel == previous) {
+				if (++run == 62 || i + 1 == pixel_count) {
+					result.push_back(static_cast<std::uint8_t>(0xc0 | (run - 1)));
+					run = 0;
+				}
+				continue;
+			}
+			if (run > 0) {
+				result.push_back(static_cast<std::uint8_t>(0xc0 | (run - 1)));
+				run = 0;
+			}
+			auto const index = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64;
+			if (seen[index] == pixel) {
+				result.push_back(static_cast<std::uint8_t>(index));
+			} else {
+				seen[index] = pixel;
+				if (pixel[3] == previous[3]) {
+					auto const dr = static_cast<std::int8_t>(pixel[0] - previous[0]);
+					auto const dg = static_cast<std::int8_t>(pixel[1] - previous[1]);
+					auto const db = static_cast<std::int8_t>(pixel[2] - previous[2]);
+					auto const dr_dg = dr - dg;
+					auto const db_dg = db - dg;
+					if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+						result.push_back(static_cast<std::uint8_t>(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+					} else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+						result.push_back(static_cast<std::uint8_t>(0x80 | (dg + 32)));
+						result.push_back(static_cast<std::uint8_t>((dr_dg + 8) << 4 | (db_dg + 8)));
+					} else {
+						result.insert(result.end(), {0xfe, pixel[0], pixel[1], pixel[2]});
+					}
+				} else {
+					result.insert(result.end(), {0xff, pixel[0], pixel[1], pixel[2], pixel[3]});
+				}
+			}
+			previous = pixel;
+		}
+		result.insert(result.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+		return result;
+	}
+
+	auto encode_image(sf::Image const& image, image_format format, int level) -> std::vector<std::uint8_t> {
+		switch (format) {
+			case image_format::png: return encode_png(image, level);
+			case image_format::qoi: return encode_qoi(image);
+		}
+		throw std::domain_error{"Unknown image format."};
+	}
+
+	auto encode_image(sf::Image const& image, encoder_settings const& settings) -> std::vector<std::uint8_t> {
+		return encode_image(image,
+			settings.format.value_or(image_format::png),
+			settings.level.value_or(get_default_compression_level()));
+	}
+}
@@ -0,0 +1,67 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Encoding of rendered images, in a choice of formats and compression levels.
+
+#pragma once
+
+#include <SFML/Graphics/Image.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace cg {
+	//! A format card-gen encodes itself. Other extensions SFML can write, such as ".jpg", ".bmp" and ".tga", are
+	//! saved with SFML.
+	enum class image_format {
+		//! PNG, deflated at a selectable compression level.
+		png,
+		//! The Quite OK Image format: lossless, a few times faster to encode and decode than PNG, somewhat larger.
+		qoi,
+	};
+
+	//! @throw std::domain_error if @p name is not "png" or "qoi".
+	auto parse_image_format(std::string const& name) -> image_format;
+
+	auto to_string(image_format format) -> std::string;
+
+	//! The file extension of @p format, including the dot.
+	auto get_extension(image_format format) -> std::string;
+
+	//! The format with the extension of @p path, if card-gen encodes it.
+	auto get_format(std::string const& path) -> std::optional<image_format>;
+
+	//! The highest compression level: slowest, and smallest output.
+	constexpr int max_compression_level = 9;
+
+	//! @throw std::domain_error if @p level is not in [0, max_compression_level].
+	auto check_compression_level(int level) -> int;
+
+	//! The compression level of outputs that do not specify one. Initially 6.
+	auto get_default_compression_level() -> int;
+	auto set_default_compression_level(int level) -> void;
+
+	//! How a card's image is encoded. Unset fields fall back to the output path's extension and the default
+	//! compression level.
+	struct encoder_settings {
+		std::optional<image_format> format;
+		//! The compression level, from 0 (stored uncompressed, fastest) to max_compression_level. Ignored by QOI.
+		std::optional<int> level;
+	};
+
+	//! Encodes @p image as PNG. Level 0 stores the pixels uncompressed. Higher levels filter rows and deflate with
+	//! longer match searches, up to adaptive per-row filtering at level 4 and above. Large images are deflated in
+	//! independent segments on several threads.
+	auto encode_png(sf::Image const& image, int level) -> std::vector<std::uint8_t>;
+
+	//! Encodes @p image as QOI.
+	auto encode_qoi(sf::Image const& image) -> std::vector<std::uint8_t>;
+
+	//! Encodes @p image as @p format, at @p level if the format is compressed.
+	auto encode_image(sf::Image const& image, image_format format, int level) -> std::vector<std::uint8_t>;
+
+	//! Encodes @p image as @p settings specify: as PNG unless a format is set, and at the default compression level
+	//! unless a level is set.
+	auto encode_image(sf::Image const& image, encoder_settings const& settings) -> std::vector<std::uint8_t>;
+}
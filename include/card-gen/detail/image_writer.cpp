@@ -0,0 +1,99 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+
+#include "image_writer.hpp"
+
+#include "profiler.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+
+namespace cg {
+	namespace {
+		//! Distinguishes the temporary files of concurrent saves to the same path.
+		std::atomic<unsigned> _last_temp_id{0};
+
+		//! A path next to @p path to write its new contents to first, with the same extension, from which SFML
+		//! infers the format.
+		auto get_temp_path(std::string const& path) -> std::filesystem::path {
+			std::filesystem::path const target{path};
+			auto const id = ++_last_temp_id;
+			return target.parent_path()
+				/ fmt::format(".{}.{}.tmp{}", target.stem().string(), id, target.extension().string());
+		}
+
+		//! Writes @p path by writing a temporary file and renaming it over @p path, via @p write, which writes to the
+		//! path it is given and returns whether it succeeded. Replacing the file rather than rewriting it in place
+		//! leaves other hard links to the old file, such as deduplicated outputs, unchanged.
+		template <typename F>
+		auto replace_file(std::string const& path, F const& write) -> bool {
+			auto const temp_path = get_temp_path(path);
+			std::error_code ec;
+			if (write(temp_path.string())) {
+				std::filesystem::rename(temp_path, path, ec);
+				if (!ec) { return true; }
+			}
+			std::filesystem::remove(temp_path, ec);
+			return false;
+		}
+	}
+
+	auto save_image(sf::Image const& image, std::string const& path, encoder_settings const& settings) -> bool {
+		scoped_timer const timer{"encode and save image"};
+		auto const format = settings.format ? settings.format : get_format(path);
+		if (format) {
+			auto const bytes = encode_image(image, *format, settings.level.value_or(get_default_compression_level()));
+			auto const saved = replace_file(path, [&](std::string const& temp_path) {
+				std::ofstream fout{temp_path, std::ios::binary};
+				fout.write(reinterpret_cast<char const*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+				return static_cast<bool>(fout);
+			});
+			if (!saved) { return false; }
+			count("bytes written", bytes.size());
+			return true;
+		}
+		if (!replace_file(path, [&](std::string const& temp_path) { return image.saveToFile(temp_path); })) {
+			return false;
+		}
+		if (profiler::is_enabled()) {
+			std::error_code ec;
+			auto const size = std::filesystem::file_size(path, ec);
+			if (!ec) { count("bytes written", size); }
+		}
+		return true;
+	}
+
+	image_writer::image_writer(unsigned thread_count, std::size_t capacity, frame_sink* frames)
+		: _queue{capacity == 0 ? std::size_t{2} * std::max(thread_count, 1u) : capacity}, _frames{frames} {
+		for (unsigned i = 0; i < std::max(thread_count, 1u); ++i) {
+			_threads.emplace_back([this] { run(); });
+		}
+	}
+
+	image_writer::~image_writer() {
+		// Closing lets the encoder threads drain the queue and then stop.
+		_queue.close();
+		for (auto& thread : _threads) {
+			thread.join();
+		}
+	}
+
+	auto image_writer::submit(sf::Image image, std::string path, encoder_settings settings) -> std::future<bool> {
+		std::promise<bool> promise;
+		auto result = promise.get_future();
+		_queue.push({std::move(image), std::move(path), settings, std::move(promise)});
+		return result;
+	}
+
+	auto image_writer::run() -> void {
+		while (auto next = _queue.pop()) {
+			next->promise.set_value(_frames //
+					? _frames->write(next->image, next->path)
+					: save_image(next->image, next->path, next->settings));
+		}
+	}
+}
@@ -0,0 +1,58 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Asynchronous image encoding and writing, decoupled from rendering.
+
+#pragma once
+
+#include "bounded_queue.hpp"
+#include "frame_sink.hpp"
+#include "image_encoder.hpp"
+
+#include <SFML/Graphics/Image.hpp>
+
+#include <cstddef>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cg {
+	//! Encodes @p image as @p settings specify and saves it to @p path. Without a format in @p settings, the format is
+	//! given by the extension of @p path; extensions card-gen does not encode itself are saved with SFML. An existing
+	//! file at @p path is replaced, not rewritten in place, so other hard links to it keep their contents.
+	//! @return Whether the image was saved successfully.
+	auto save_image(sf::Image const& image, std::string const& path, encoder_settings const& settings = {}) -> bool;
+
+	//! Encodes and writes images on a set of encoder threads, fed by a bounded queue.
+	struct image_writer {
+		//! @param thread_count The number of encoder threads; at least one is always used.
+		//! @param capacity The maximum number of queued images, or zero for twice the number of threads.
+		//! @param frames If not null, images are written to @p frames as raw frames named by their paths instead of
+		//! being encoded and saved. Must outlive the writer.
+		image_writer(unsigned thread_count = 1, std::size_t capacity = 0, frame_sink* frames = nullptr);
+
+		//! Finishes all queued writes before returning.
+		~image_writer();
+
+		image_writer(image_writer const&) = delete;
+		auto operator=(image_writer const&) -> image_writer& = delete;
+
+		//! Queues @p image to be saved to @p path with @p settings, blocking while the queue is full.
+		//! @return A future that becomes true if the image was saved successfully or false otherwise.
+		auto submit(sf::Image image, std::string path, encoder_settings settings = {}) -> std::future<bool>;
+
+	private:
+		struct task {
+			sf::Image image;
+			std::string path;
+			encoder_settings settings;
+			std::promise<bool> promise;
+		};
+
+		bounded_queue<task> _queue;
+		frame_sink* _frames;
+		std::vector<std::thread> _threads;
+
+		auto run() -> void;
+	};
+}
@@ -0,0 +1,43 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+
+#include "interned_string.hpp"
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace cg {
+	namespace {
+		struct string_pool {
+			std::mutex mutex;
+			//! Each pooled string, keyed by a view of itself so that lookups do not allocate. The strings are held by
+			//! pointer, so they stay put as the pool grows.
+			std::unordered_map<std::string_view, std::unique_ptr<std::string const>> strings;
+		};
+
+		auto get_pool() -> string_pool& {
+			// Never destroyed, so interned strings stay valid in static destructors.
+			static auto const result = new string_pool;
+			return *result;
+		}
+
+		auto intern(std::string_view value) -> std::string const* {
+			auto& pool = get_pool();
+			std::lock_guard lock{pool.mutex};
+			auto const it = pool.strings.find(value);
+			if (it != pool.strings.end()) { return it->second.get(); }
+			auto string = std::make_unique<std::string const>(value);
+			auto const result = string.get();
+			pool.strings.emplace(*result, std::move(string));
+			return result;
+		}
+	}
+
+	interned_string::interned_string() {
+		static auto const empty = intern({});
+		_value = empty;
+	}
+
+	interned_string::interned_string(std::string_view value) : _value{intern(value)} {}
+}
@@ -0,0 +1,45 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Immutable strings shared through a process-wide pool, for values repeated across many cards.
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace cg {
+	//! A string interned in a process-wide pool, so that equal strings share one immutable copy. Interning costs a
+	//! hash lookup; afterward, copying an interned string allocates nothing and comparing two compares pointers.
+	//! @note Pooled strings are never freed, so intern values drawn from a bounded set, such as asset paths.
+	struct interned_string {
+		//! The empty string.
+		interned_string();
+
+		interned_string(std::string_view value);
+		interned_string(std::string const& value) : interned_string{std::string_view{value}} {}
+		interned_string(char const* value) : interned_string{std::string_view{value}} {}
+
+		auto str() const -> std::string const& {
+			return *_value;
+		}
+
+		operator std::string const&() const {
+			return *_value;
+		}
+
+		auto empty() const -> bool {
+			return _value->empty();
+		}
+
+		friend auto operator==(interned_string const& a, interned_string const& b) -> bool {
+			return a._value == b._value;
+		}
+
+		friend auto operator!=(interned_string const& a, interned_string const& b) -> bool {
+			return a._value != b._value;
+		}
+
+	private:
+		std::string const* _value;
+	};
+}
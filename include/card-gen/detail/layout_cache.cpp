@@ -0,0 +1,55 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+
+#include "layout_cache.hpp"
+
+#include "font_cache.hpp"
+#include "profiler.hpp"
+
+namespace cg {
+	auto layout_cache::local() -> layout_cache& {
+		thread_local layout_cache result;
+		return result;
+	}
+
+	layout_cache::layout_cache(std::size_t capacity)
+		: _capacity{capacity}, _font_generation{font_cache::instance().get_generation()} {}
+
+	auto layout_cache::get(sf::String const& markup, unsigned character_size) -> std::shared_ptr<sfe::rich_text const> {
+		// Fonts may have been reloaded, destroying the instances the cached layouts refer to.
+		auto const font_generation = font_cache::instance().get_generation();
+		if (font_generation != _font_generation) {
+			clear();
+			_font_generation = font_generation;
+		}
+
+		bool const batched = sfe::rich_text::is_default_batched();
+		std::string key(reinterpret_cast<char const*>(markup.getData()), markup.getSize() * sizeof(sf::Uint32));
+		key.append(reinterpret_cast<char const*>(&character_size), sizeof(character_size));
+		key.push_back(batched ? 'b' : 'u');
+
+		auto const index_it = _index.find(key);
+		if (index_it != _index.end()) {
+			// Cache hit. Move the entry to the front.
+			count("layout cache hits");
+			_entries.splice(_entries.begin(), _entries, index_it->second);
+			return index_it->second->layout;
+		}
+
+		// Cache miss. Need to lay out the text.
+		count("layout cache misses");
+		auto layout = std::make_shared<sfe::rich_text const>(markup, character_size);
+		_entries.push_front({key, std::move(layout)});
+		_index.emplace(std::move(key), _entries.begin());
+		while (_entries.size() > _capacity && _entries.size() > 1) {
+			_index.erase(_entries.back().key);
+			_entries.pop_back();
+		}
+		return _entries.front().layout;
+	}
+
+	auto layout_cache::clear() -> void {
+		_index.clear();
+		_entries.clear();
+	}
+}
@@ -0,0 +1,53 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Per-thread cache of laid-out rich text, for text elements repeated across cards.
+
+#pragma once
+
+#include "rich_text.hpp"
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace cg {
+	//! Laid-out rich text keyed by markup, character size and batching, so that text shared by many cards, such as
+	//! keyword boxes and cost lines, is parsed and laid out once per thread. Layouts refer to the thread's instances
+	//! of their fonts, so each thread has its own cache, and a cache is emptied whenever the font registry changes.
+	struct layout_cache {
+		//! Default limit on the number of cached layouts per thread.
+		static constexpr std::size_t default_capacity = 1024;
+
+		//! The calling thread's layout cache.
+		static auto local() -> layout_cache&;
+
+		layout_cache(std::size_t capacity = default_capacity);
+
+		layout_cache(layout_cache const&) = delete;
+		auto operator=(layout_cache const&) -> layout_cache& = delete;
+
+		//! Gets the layout of @p markup at @p character_size, laying it out on a cache miss. The layout is shared with
+		//! other holders, so position it with a separate transform rather than modifying it.
+		//! @note The returned layout remains valid even if it is later evicted from the cache.
+		//! @throw std::domain_error if @p markup is invalid.
+		auto get(sf::String const& markup, unsigned character_size) -> std::shared_ptr<sfe::rich_text const>;
+
+		auto clear() -> void;
+
+	private:
+		struct entry {
+			std::string key;
+			std::shared_ptr<sfe::rich_text const> layout;
+		};
+
+		//! Cached entries, from most to least recently used.
+		std::list<entry> _entries;
+		std::unordered_map<std::string, std::list<entry>::iterator> _index;
+
+		std::size_t _capacity;
+		//! The font registry's generation when the cached layouts were made.
+		unsigned _font_generation;
+	};
+}
@@ -0,0 +1,193 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Thread-safe keyed cache of images or textures with a memory cap and least-recently-used eviction.
+
+#pragma once
+
+#include "profiler.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace cg {
+	//! Caches shared, immutable values of type @p T, such as sf::Image or sf::Texture, under string keys. Each value's
+	//! size is estimated from its getSize(), assuming 32-bit RGBA pixels, and the least recently used values are
+	//! evicted to keep the total under a capacity. Values are made outside the cache's lock, so threads missing
+	//! different keys make their values concurrently, while threads missing the same key wait for the first to make it.
+	template <typename T>
+	struct lru_cache {
+		//! Profiler counter and timer names, which must outlive the profiler, e.g. string literals.
+		struct labels {
+			char const* hits;
+			char const* misses;
+			char const* make;
+		};
+
+		lru_cache(labels names, std::size_t capacity) : _labels{names}, _capacity{capacity} {}
+
+		lru_cache(lru_cache const&) = delete;
+		auto operator=(lru_cache const&) -> lru_cache& = delete;
+
+		//! Gets the value cached under @p key. On a cache miss, calls @p make, which returns a
+		//! std::shared_ptr<T const>, to make it.
+		//! @note The returned value remains valid even if it is later evicted from the cache.
+		//! @throw Whatever @p make throws, including to threads that were waiting for the same key.
+		template <typename F>
+		auto get(std::string const& key, F const& make) -> std::shared_ptr<T const> {
+			std::unique_lock lock{_mutex};
+			auto const index_it = _index.find(key);
+			if (index_it != _index.end()) {
+				// Cache hit. Move the entry to the front.
+				count(_labels.hits);
+				_entries.splice(_entries.begin(), _entries, index_it->second);
+				return index_it->second->value;
+			}
+			auto const pending_it = _pending.find(key);
+			if (pending_it != _pending.end()) {
+				// Another thread is making this value. Wait for it rather than making it again.
+				count(_labels.hits);
+				auto const value = pending_it->second.value;
+				lock.unlock();
+				return value.get();
+			}
+
+			// Cache miss. Make the value without holding the lock.
+			count(_labels.misses);
+			std::promise<std::shared_ptr<T const>> promise;
+			auto const id = ++_last_pending_id;
+			_pending.emplace(key, pending{promise.get_future().share(), id});
+			lock.unlock();
+			std::shared_ptr<T const> value;
+			try {
+				scoped_timer const timer{_labels.make};
+				value = make();
+			} catch (...) {
+				promise.set_exception(std::current_exception());
+				lock.lock();
+				erase_pending(key, id);
+				throw;
+			}
+			promise.set_value(value);
+
+			lock.lock();
+			// If the key was erased in the meantime, the value may be out of date, so do not cache it.
+			if (erase_pending(key, id)) {
+				auto const size = get_byte_size(*value);
+				_entries.push_front({key, value, size});
+				_index.emplace(key, _entries.begin());
+				_size += size;
+				evict();
+			}
+			return value;
+		}
+
+		auto get_capacity() const -> std::size_t {
+			std::lock_guard lock{_mutex};
+			return _capacity;
+		}
+
+		//! Sets the memory cap, evicting least-recently-used values as needed.
+		auto set_capacity(std::size_t capacity) -> void {
+			std::lock_guard lock{_mutex};
+			_capacity = capacity;
+			evict();
+		}
+
+		//! The approximate total size of cached values, in bytes.
+		auto get_size() const -> std::size_t {
+			std::lock_guard lock{_mutex};
+			return _size;
+		}
+
+		//! Removes the value cached under @p key, if any, and the values derived from it, whose keys start with @p key
+		//! followed by '#' (see resampled_key), so that they are made again on next use. Values being made under those
+		//! keys are not cached.
+		auto erase(std::string const& key) -> void {
+			std::lock_guard lock{_mutex};
+			auto const is_erased = [&](std::string const& k) {
+				return k == key || k.compare(0, key.size() + 1, key + '#') == 0;
+			};
+			for (auto it = _entries.begin(); it != _entries.end();) {
+				if (is_erased(it->key)) {
+					_size -= it->size;
+					_index.erase(it->key);
+					it = _entries.erase(it);
+				} else {
+					++it;
+				}
+			}
+			for (auto it = _pending.begin(); it != _pending.end();) {
+				it = is_erased(it->first) ? _pending.erase(it) : std::next(it);
+			}
+		}
+
+		auto clear() -> void {
+			std::lock_guard lock{_mutex};
+			_entries.clear();
+			_index.clear();
+			_pending.clear();
+			_size = 0;
+		}
+
+	private:
+		struct entry {
+			std::string key;
+			std::shared_ptr<T const> value;
+			std::size_t size;
+		};
+
+		//! A value being made, which threads missing the same key wait for.
+		struct pending {
+			std::shared_future<std::shared_ptr<T const>> value;
+			//! Identifies the thread making the value, in case the key is erased and missed again meanwhile.
+			std::uint64_t id;
+		};
+
+		labels _labels;
+
+		mutable std::mutex _mutex;
+
+		//! Cached entries, from most to least recently used.
+		std::list<entry> _entries;
+		std::unordered_map<std::string, typename std::list<entry>::iterator> _index;
+		std::unordered_map<std::string, pending> _pending;
+		std::uint64_t _last_pending_id = 0;
+
+		std::size_t _capacity;
+		std::size_t _size = 0;
+
+		static auto get_byte_size(T const& value) -> std::size_t {
+			auto const size = value.getSize();
+			return std::size_t{4} * size.x * size.y;
+		}
+
+		//! Stops waiting threads from finding the pending value under @p key made by @p id.
+		//! @return Whether the value was still pending, i.e. its key was not erased meanwhile.
+		//! @note The caller must hold the mutex.
+		auto erase_pending(std::string const& key, std::uint64_t id) -> bool {
+			auto const it = _pending.find(key);
+			if (it == _pending.end() || it->second.id != id) { return false; }
+			_pending.erase(it);
+			return true;
+		}
+
+		//! Evicts least-recently-used entries until the cache fits its capacity or only one entry remains.
+		//! @note The caller must hold the mutex.
+		auto evict() -> void {
+			while (_size > _capacity && _entries.size() > 1) {
+				auto const& lru = _entries.back();
+				_size -= lru.size;
+				_index.erase(lru.key);
+				_entries.pop_back();
+			}
+		}
+	};
+}
@@ -0,0 +1,106 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+
+#include "mapped_file.hpp"
+
+#include <fmt/format.h>
+
+#include <atomic>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cg {
+	namespace {
+		std::atomic<mapped_file::mode> _default_mode{mapped_file::mode::map};
+	}
+
+	auto mapped_file::get_default_mode() -> mode {
+		return _default_mode.load(std::memory_order_relaxed);
+	}
+
+	auto mapped_file::set_default_mode(mode m) -> void {
+		_default_mode.store(m, std::memory_order_relaxed);
+	}
+
+	mapped_file::mapped_file(std::string const& path, mode m) {
+		if (m == mode::map) {
+			map(path);
+			return;
+		}
+		std::ifstream fin{path, std::ios::binary | std::ios::ate};
+		if (!fin.is_open()) { throw std::runtime_error{fmt::format("Could not open \"{}\".", path)}; }
+		_copy.resize(static_cast<std::size_t>(fin.tellg()));
+		fin.seekg(0);
+		if (!fin.read(_copy.data(), static_cast<std::streamsize>(_copy.size()))) {
+			throw std::runtime_error{fmt::format("Could not read \"{}\".", path)};
+		}
+		_size = _copy.size();
+		if (_size > 0) { _data = _copy.data(); }
+	}
+
+#ifdef _WIN32
+	auto mapped_file::map(std::string const& path) -> void {
+		auto const file = CreateFileA(
+			path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) { throw std::runtime_error{fmt::format("Could not open \"{}\".", path)}; }
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size)) {
+			CloseHandle(file);
+			throw std::runtime_error{fmt::format("Could not get the size of \"{}\".", path)};
+		}
+		_size = static_cast<std::size_t>(file_size.QuadPart);
+		if (_size == 0) {
+			// Empty files cannot be mapped.
+			CloseHandle(file);
+			return;
+		}
+		auto const mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		CloseHandle(file);
+		if (mapping == nullptr) { throw std::runtime_error{fmt::format("Could not map \"{}\".", path)}; }
+		// The view keeps the mapping alive.
+		_data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		if (_data == nullptr) { throw std::runtime_error{fmt::format("Could not map \"{}\".", path)}; }
+	}
+
+	mapped_file::~mapped_file() {
+		if (_data != nullptr && _copy.empty()) { UnmapViewOfFile(_data); }
+	}
+#else
+	auto mapped_file::map(std::string const& path) -> void {
+		auto const fd = open(path.c_str(), O_RDONLY);
+		if (fd == -1) { throw std::runtime_error{fmt::format("Could not open \"{}\".", path)}; }
+		struct stat file_status;
+		if (fstat(fd, &file_status) == -1) {
+			close(fd);
+			throw std::runtime_error{fmt::format("Could not get the size of \"{}\".", path)};
+		}
+		_size = static_cast<std::size_t>(file_status.st_size);
+		if (_size == 0) {
+			// Empty files cannot be mapped.
+			close(fd);
+			return;
+		}
+		auto const data = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+		// The mapping stays valid after the file is closed.
+		close(fd);
+		if (data == MAP_FAILED) { throw std::runtime_error{fmt::format("Could not map \"{}\".", path)}; }
+		_data = data;
+	}
+
+	mapped_file::~mapped_file() {
+		if (_data != nullptr && _copy.empty()) { munmap(const_cast<void*>(_data), _size); }
+	}
+#endif
+}
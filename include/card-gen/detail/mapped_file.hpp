@@ -0,0 +1,58 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Read-only memory-mapped files.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace cg {
+	//! A file mapped read-only into memory. Mappings of the same file share the operating system's page cache, even
+	//! across processes. A file may instead be copied into private memory, for files that may change while loaded.
+	struct mapped_file {
+		//! How a file's contents are held.
+		enum class mode {
+			//! Mapped into memory. The file must not be modified in place while mapped: on POSIX systems, reading
+			//! pages past the end of a truncated file raises SIGBUS, and on Windows, the mapping stops other
+			//! programs from writing the file. Replacing the file, e.g. by renaming a new file over it, is safe.
+			map,
+			//! Read into private memory, so that later changes to the file do not affect the contents.
+			copy,
+		};
+
+		//! The mode of files opened without one. Initially mode::map.
+		static auto get_default_mode() -> mode;
+		static auto set_default_mode(mode m) -> void;
+
+		//! Opens the file at @p path in the default mode.
+		//! @throw std::runtime_error if the file could not be opened, mapped or read.
+		mapped_file(std::string const& path) : mapped_file{path, get_default_mode()} {}
+
+		//! @throw std::runtime_error if the file could not be opened, mapped or read.
+		mapped_file(std::string const& path, mode m);
+		~mapped_file();
+
+		mapped_file(mapped_file const&) = delete;
+		auto operator=(mapped_file const&) -> mapped_file& = delete;
+
+		//! The file's contents, or null if the file is empty.
+		auto data() const -> void const* {
+			return _data;
+		}
+
+		auto size() const -> std::size_t {
+			return _size;
+		}
+
+	private:
+		void const* _data = nullptr;
+		std::size_t _size = 0;
+		//! The contents of a copied file.
+		std::vector<char> _copy;
+
+		//! Maps the file at @p path, setting _data and _size.
+		auto map(std::string const& path) -> void;
+	};
+}
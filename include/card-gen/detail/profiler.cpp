@@ -0,0 +1,145 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+
+#include "profiler.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+
+namespace cg {
+	namespace {
+		struct scope_stats {
+			std::uint64_t count = 0;
+			profiler::clock::duration total{};
+			profiler::clock::duration max{};
+		};
+
+		struct event {
+			char const* name;
+			profiler::clock::time_point start;
+			profiler::clock::time_point end;
+		};
+
+		auto to_ms(profiler::clock::duration d) -> double {
+			return std::chrono::duration<double, std::milli>(d).count();
+		}
+
+		auto save_json(nlohmann::json const& j, std::string const& path) -> bool {
+			std::ofstream fout{path};
+			fout << j.dump(1, '\t') << '\n';
+			return static_cast<bool>(fout);
+		}
+	}
+
+	//! One thread's records. Only its own thread writes to it, so its mutex is contended only while saving.
+	struct profiler::thread_data {
+		unsigned id;
+		std::mutex mutex;
+		std::unordered_map<char const*, scope_stats> scopes;
+		std::unordered_map<char const*, std::uint64_t> counters;
+		std::vector<event> events;
+	};
+
+	auto profiler::instance() -> profiler& {
+		static profiler result;
+		return result;
+	}
+
+	auto profiler::enable(bool trace) -> void {
+		_trace = trace;
+		_start = clock::now();
+		_enabled.store(true, std::memory_order_release);
+	}
+
+	auto profiler::record(char const* name, clock::time_point start, clock::time_point end) -> void {
+		auto& data = local();
+		std::lock_guard lock{data.mutex};
+		auto& stats = data.scopes[name];
+		++stats.count;
+		stats.total += end - start;
+		stats.max = std::max(stats.max, end - start);
+		if (_trace.load(std::memory_order_relaxed)) { data.events.push_back({name, start, end}); }
+	}
+
+	auto profiler::add(char const* name, std::uint64_t amount) -> void {
+		auto& data = local();
+		std::lock_guard lock{data.mutex};
+		data.counters[name] += amount;
+	}
+
+	auto profiler::save_summary(std::string const& path) const -> bool {
+		// The same name may have different addresses in different translation units, so merge by value.
+		std::map<std::string, scope_stats> scopes;
+		std::map<std::string, std::uint64_t> counters;
+		{
+			std::lock_guard threads_lock{_threads_mutex};
+			for (auto const& data : _threads) {
+				std::lock_guard lock{data->mutex};
+				for (auto const& [name, stats] : data->scopes) {
+					auto& merged = scopes[name];
+					merged.count += stats.count;
+					merged.total += stats.total;
+					merged.max = std::max(merged.max, stats.max);
+				}
+				for (auto const& [name, total] : data->counters) {
+					counters[name] += total;
+				}
+			}
+		}
+
+		nlohmann::json j{{"wall_ms", to_ms(clock::now() - _start)}, {"scopes", nlohmann::json::object()}};
+		for (auto const& [name, stats] : scopes) {
+			j["scopes"][name] = {{"count", stats.count},
+				{"total_ms", to_ms(stats.total)},
+				{"mean_ms", to_ms(stats.total) / stats.count},
+				{"max_ms", to_ms(stats.max)}};
+		}
+		j["counters"] = counters;
+		return save_json(j, path);
+	}
+
+	auto profiler::save_trace(std::string const& path) const -> bool {
+		auto const to_us = [&](clock::time_point t) {
+			return std::chrono::duration<double, std::micro>(t - _start).count();
+		};
+		auto j_events = nlohmann::json::array();
+		std::map<std::string, std::uint64_t> counters;
+		{
+			std::lock_guard threads_lock{_threads_mutex};
+			for (auto const& data : _threads) {
+				std::lock_guard lock{data->mutex};
+				for (auto const& e : data->events) {
+					j_events.push_back({{"name", e.name},
+						{"ph", "X"},
+						{"ts", to_us(e.start)},
+						{"dur", to_us(e.end) - to_us(e.start)},
+						{"pid", 1},
+						{"tid", data->id}});
+				}
+				for (auto const& [name, total] : data->counters) {
+					counters[name] += total;
+				}
+			}
+		}
+		auto const end = to_us(clock::now());
+		for (auto const& [name, total] : counters) {
+			j_events.push_back({{"name", name}, {"ph", "C"}, {"ts", end}, {"pid", 1}, {"args", {{"value", total}}}});
+		}
+		return save_json({{"traceEvents", std::move(j_events)}, {"displayTimeUnit", "ms"}}, path);
+	}
+
+	auto profiler::local() -> thread_data& {
+		thread_local std::shared_ptr<thread_data> result;
+		if (!result) {
+			result = std::make_shared<thread_data>();
+			std::lock_guard lock{_threads_mutex};
+			result->id = static_cast<unsigned>(_threads.size());
+			_threads.push_back(result);
+		}
+		return *result;
+	}
+}
@@ -0,0 +1,95 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Timing of rendering stages and counting of events, for finding where render time goes.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace cg {
+	//! Collects the durations of timed scopes and the totals of counters from every thread. Disabled by default, in
+	//! which case instrumentation costs one relaxed atomic load and a branch and records nothing.
+	struct profiler {
+		using clock = std::chrono::steady_clock;
+
+		static auto instance() -> profiler&;
+
+		//! Whether timings and counts are being recorded.
+		static auto is_enabled() -> bool {
+			return _enabled.load(std::memory_order_relaxed);
+		}
+
+		//! Starts recording. If @p trace, every timed scope is also kept as an event for save_trace, so memory grows
+		//! with the number of scopes; otherwise only per-name totals are kept.
+		auto enable(bool trace) -> void;
+
+		//! Records that the scope @p name ran from @p start to @p end on this thread. @p name must outlive the
+		//! profiler, e.g. a string literal.
+		auto record(char const* name, clock::time_point start, clock::time_point end) -> void;
+
+		//! Adds @p amount to counter @p name. @p name must outlive the profiler, e.g. a string literal.
+		auto add(char const* name, std::uint64_t amount) -> void;
+
+		//! Saves the count, total, mean and maximum duration of each timed scope and the total of each counter to
+		//! @p path as JSON.
+		//! @return Whether the summary was saved successfully.
+		auto save_summary(std::string const& path) const -> bool;
+
+		//! Saves every recorded scope and the final counter totals to @p path in the Chrome trace event format, for
+		//! viewing in chrome://tracing or Perfetto.
+		//! @return Whether the trace was saved successfully.
+		auto save_trace(std::string const& path) const -> bool;
+
+	private:
+		struct thread_data;
+
+		inline static std::atomic<bool> _enabled = false;
+
+		std::atomic<bool> _trace = false;
+		clock::time_point _start;
+
+		mutable std::mutex _threads_mutex;
+		//! Every thread's data, kept after the thread exits so that its records are saved.
+		std::vector<std::shared_ptr<thread_data>> _threads;
+
+		//! The calling thread's data, registered on first use.
+		auto local() -> thread_data&;
+	};
+
+	//! Records the time from construction to destruction (or stop) as a scope named @p name, if profiling is enabled.
+	struct scoped_timer {
+		explicit scoped_timer(char const* name) : _name{profiler::is_enabled() ? name : nullptr} {
+			if (_name) { _start = profiler::clock::now(); }
+		}
+
+		~scoped_timer() {
+			stop();
+		}
+
+		scoped_timer(scoped_timer const&) = delete;
+		auto operator=(scoped_timer const&) -> scoped_timer& = delete;
+
+		//! Ends the scope early. Later calls and destruction record nothing more.
+		auto stop() -> void {
+			if (_name) {
+				profiler::instance().record(_name, _start, profiler::clock::now());
+				_name = nullptr;
+			}
+		}
+
+	private:
+		char const* _name;
+		profiler::clock::time_point _start;
+	};
+
+	//! Adds @p amount to counter @p name, if profiling is enabled.
+	inline auto count(char const* name, std::uint64_t amount = 1) -> void {
+		if (profiler::is_enabled()) { profiler::instance().add(name, amount); }
+	}
+}
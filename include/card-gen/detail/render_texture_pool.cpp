@@ -0,0 +1,70 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+
+#include "render_texture_pool.hpp"
+
+#include "profiler.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace cg {
+	namespace {
+		auto get_byte_size(sf::Vector2u size) -> std::size_t {
+			return std::size_t{4} * size.x * size.y;
+		}
+	}
+
+	render_texture_pool::lease::~lease() {
+		// Moved-from leases have nothing to return.
+		if (_texture) { _pool->release(_size, std::move(_texture)); }
+	}
+
+	auto render_texture_pool::local() -> render_texture_pool& {
+		thread_local render_texture_pool result;
+		return result;
+	}
+
+	auto render_texture_pool::acquire(sf::Vector2u size) -> lease {
+		auto const it =
+			std::find_if(_free.begin(), _free.end(), [&](free_texture const& free) { return free.size == size; });
+		if (it != _free.end()) {
+			count("render texture pool hits");
+			auto texture = std::move(it->texture);
+			_size -= get_byte_size(size);
+			_free.erase(it);
+			return {*this, size, std::move(texture)};
+		}
+		count("render texture pool misses");
+		auto texture = std::make_unique<sf::RenderTexture>();
+		if (!texture->create(size.x, size.y)) {
+			throw std::runtime_error{fmt::format("Could not create {}x{} render texture.", size.x, size.y)};
+		}
+		return {*this, size, std::move(texture)};
+	}
+
+	auto render_texture_pool::clear() -> void {
+		_free.clear();
+		_size = 0;
+	}
+
+	auto render_texture_pool::set_capacity(std::size_t capacity) -> void {
+		_capacity = capacity;
+		evict();
+	}
+
+	auto render_texture_pool::release(sf::Vector2u size, std::unique_ptr<sf::RenderTexture> texture) -> void {
+		_free.push_front({size, std::move(texture)});
+		_size += get_byte_size(size);
+		evict();
+	}
+
+	auto render_texture_pool::evict() -> void {
+		while (_size > _capacity && !_free.empty()) {
+			_size -= get_byte_size(_free.back().size);
+			_free.pop_back();
+		}
+	}
+}
@@ -0,0 +1,86 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Pool of reusable render textures, keyed by size, with a memory cap and least-recently-used eviction.
+
+#pragma once
+
+#include <SFML/Graphics/RenderTexture.hpp>
+
+#include <cstddef>
+#include <list>
+#include <memory>
+
+namespace cg {
+	//! Keeps render textures that are not in use for reuse by later cards of the same size. Free textures are sized
+	//! assuming 32-bit RGBA pixels, and the least recently returned are destroyed to keep their total under a
+	//! capacity, so that a stream of distinct card sizes does not accumulate textures.
+	struct render_texture_pool {
+		//! The default cap on the memory of a pool's free render textures, in bytes.
+		static constexpr std::size_t default_capacity = std::size_t{256} << 20;
+
+		//! A render texture borrowed from a pool, returned to the pool on destruction.
+		struct lease {
+			lease(render_texture_pool& pool, sf::Vector2u size, std::unique_ptr<sf::RenderTexture> texture)
+				: _pool{&pool}, _size{size}, _texture{std::move(texture)} {}
+
+			lease(lease&&) = default;
+			auto operator=(lease&&) -> lease& = delete;
+
+			~lease();
+
+			auto operator*() const -> sf::RenderTexture& {
+				return *_texture;
+			}
+			auto operator->() const -> sf::RenderTexture* {
+				return _texture.get();
+			}
+
+		private:
+			render_texture_pool* _pool;
+			sf::Vector2u _size;
+			std::unique_ptr<sf::RenderTexture> _texture;
+		};
+
+		//! The calling thread's pool. Render textures belong to their thread's GL context, so each thread has its
+		//! own pool.
+		static auto local() -> render_texture_pool&;
+
+		render_texture_pool(std::size_t capacity = default_capacity) : _capacity{capacity} {}
+
+		render_texture_pool(render_texture_pool const&) = delete;
+		auto operator=(render_texture_pool const&) -> render_texture_pool& = delete;
+
+		//! Borrows a render texture of the given @p size, creating one if none is free. Its contents are unspecified;
+		//! clear it before drawing.
+		//! @throw std::runtime_error if a new render texture could not be created.
+		auto acquire(sf::Vector2u size) -> lease;
+
+		//! Destroys all free render textures.
+		auto clear() -> void;
+
+		auto get_capacity() const -> std::size_t {
+			return _capacity;
+		}
+
+		//! Sets the memory cap, destroying least-recently-returned free textures as needed.
+		auto set_capacity(std::size_t capacity) -> void;
+
+	private:
+		struct free_texture {
+			sf::Vector2u size;
+			std::unique_ptr<sf::RenderTexture> texture;
+		};
+
+		//! Free textures, from most to least recently returned.
+		std::list<free_texture> _free;
+		std::size_t _capacity;
+		//! The approximate total size of the free textures, in bytes.
+		std::size_t _size = 0;
+
+		//! Returns @p texture of size @p size to the pool.
+		auto release(sf::Vector2u size, std::unique_ptr<sf::RenderTexture> texture) -> void;
+
+		//! Destroys least-recently-returned free textures until the free textures fit the capacity.
+		auto evict() -> void;
+	};
+}
@@ -0,0 +1,234 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+
+#include "resample.hpp"
+
+#include "mapped_file.hpp"
+#include "profiler.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+namespace cg {
+	namespace {
+		std::atomic<resample_filter> _default_filter = resample_filter::none;
+
+		constexpr float pi = 3.14159265358979f;
+
+		auto sinc(float x) -> float {
+			if (x == 0) { return 1; }
+			x *= pi;
+			return std::sin(x) / x;
+		}
+
+		//! The half-width of @p filter's kernel, in source pixels at unit scale.
+		auto get_support(resample_filter filter) -> float {
+			switch (filter) {
+				case resample_filter::lanczos:
+					return 3;
+				default:
+					return 0.5f;
+			}
+		}
+
+		auto kernel(resample_filter filter, float x) -> float {
+			switch (filter) {
+				case resample_filter::lanczos:
+					return std::abs(x) < 3 ? sinc(x) * sinc(x / 3) : 0;
+				default:
+					return -0.5f <= x && x < 0.5f ? 1.f : 0.f;
+			}
+		}
+
+		//! The source pixels and normalized weights that make up each output pixel along one axis.
+		struct contributions {
+			//! For each output pixel, the index of its first source pixel and of its first weight.
+			std::vector<unsigned> first_source;
+			std::vector<std::size_t> first_weight;
+			//! For each output pixel, its weights, one per consecutive source pixel.
+			std::vector<float> weights;
+
+			auto count(std::size_t i) const -> std::size_t {
+				auto const end = i + 1 < first_weight.size() ? first_weight[i + 1] : weights.size();
+				return end - first_weight[i];
+			}
+		};
+
+		auto get_contributions(unsigned source_size, unsigned target_size, resample_filter filter) -> contributions {
+			contributions result;
+			float const scale = static_cast<float>(target_size) / source_size;
+			// When downscaling, widen the kernel to cover every source pixel.
+			float const filter_scale = std::max(1.f, 1 / scale);
+			float const radius = get_support(filter) * filter_scale;
+			for (unsigned i = 0; i < target_size; ++i) {
+				float const center = (i + 0.5f) / scale;
+				int const begin = std::max(static_cast<int>(std::floor(center - radius)), 0);
+				int const end = std::min(static_cast<int>(std::ceil(center + radius)), static_cast<int>(source_size));
+				auto const first = result.weights.size();
+				float total = 0;
+				for (int j = begin; j < end; ++j) {
+					float const weight = kernel(filter, (j + 0.5f - center) / filter_scale);
+					result.weights.push_back(weight);
+					total += weight;
+				}
+				if (total == 0) {
+					// The kernel missed every pixel center; fall back to the nearest pixel.
+					result.weights.resize(first);
+					auto const nearest = std::clamp(static_cast<int>(center), 0, static_cast<int>(source_size) - 1);
+					result.first_source.push_back(nearest);
+					result.first_weight.push_back(first);
+					result.weights.push_back(1);
+					continue;
+				}
+				for (auto k = first; k < result.weights.size(); ++k) {
+					result.weights[k] /= total;
+				}
+				result.first_source.push_back(begin);
+				result.first_weight.push_back(first);
+			}
+			return result;
+		}
+
+		//! Resamples rows of premultiplied RGBA floats along one axis. Pixel (x, y) of the input is at
+		//! input[4 * (x * x_stride + y * y_stride)], and contributions run along x.
+		//! @note The inner loop is a multiply-add over four contiguous channels, which compilers vectorize.
+		auto resample_axis(std::vector<float> const& input,
+			std::size_t x_stride,
+			std::size_t y_stride,
+			std::size_t lines,
+			contributions const& c,
+			std::vector<float>& output,
+			std::size_t out_x_stride,
+			std::size_t out_y_stride) -> void {
+			for (std::size_t y = 0; y < lines; ++y) {
+				for (std::size_t i = 0; i < c.first_source.size(); ++i) {
+					float sum[4] = {};
+					auto const weights = c.weights.data() + c.first_weight[i];
+					auto const count = c.count(i);
+					for (std::size_t k = 0; k < count; ++k) {
+						auto const src = &input[4 * ((c.first_source[i] + k) * x_stride + y * y_stride)];
+						for (int channel = 0; channel < 4; ++channel) {
+							sum[channel] += weights[k] * src[channel];
+						}
+					}
+					auto const dst = &output[4 * (i * out_x_stride + y * out_y_stride)];
+					std::copy(sum, sum + 4, dst);
+				}
+			}
+		}
+	}
+
+	auto parse_resample_filter(std::string const& name) -> resample_filter {
+		if (name == "none") { return resample_filter::none; }
+		if (name == "box") { return resample_filter::box; }
+		if (name == "lanczos") { return resample_filter::lanczos; }
+		throw std::domain_error{
+			fmt::format("Unknown resample filter \"{}\"; expected \"none\", \"box\" or \"lanczos\".", name)};
+	}
+
+	auto to_string(resample_filter filter) -> std::string {
+		switch (filter) {
+			case resample_filter::box:
+				return "box";
+			case resample_filter::lanczos:
+				return "lanczos";
+			default:
+				return "none";
+		}
+	}
+
+	auto get_default_resample_filter() -> resample_filter {
+		return _default_filter;
+	}
+
+	auto set_default_resample_filter(resample_filter filter) -> void {
+		_default_filter = filter;
+	}
+
+	auto load_image(std::string const& path) -> sf::Image {
+		// Decode straight from the page cache. The mapping is only needed until the image is decoded.
+		std::optional<mapped_file> file;
+		try {
+			file.emplace(path);
+		} catch (std::runtime_error const&) {
+			throw std::runtime_error{fmt::format("Could not load image from \"{}\".", path)};
+		}
+		sf::Image result;
+		if (!result.loadFromMemory(file->data(), file->size())) {
+			throw std::runtime_error{fmt::format("Could not load image from \"{}\".", path)};
+		}
+		return result;
+	}
+
+	auto resample(sf::Image const& source, sf::Vector2u size, resample_filter filter) -> sf::Image {
+		scoped_timer const timer{"resample image"};
+		auto const source_size = source.getSize();
+		sf::Image result;
+		if (size.x == 0 || size.y == 0 || source_size.x == 0 || source_size.y == 0) {
+			result.create(size.x, size.y);
+			return result;
+		}
+		auto const pixels = source.getPixelsPtr();
+
+		if (filter == resample_filter::none) {
+			// Each output pixel takes the source pixel under its center.
+			std::vector<sf::Uint8> out(4 * std::size_t{size.x} * size.y);
+			for (std::size_t y = 0; y < size.y; ++y) {
+				auto const src_y = (2 * y + 1) * source_size.y / (2 * size.y);
+				for (std::size_t x = 0; x < size.x; ++x) {
+					auto const src_x = (2 * x + 1) * source_size.x / (2 * size.x);
+					std::copy_n(&pixels[4 * (src_y * source_size.x + src_x)], 4, &out[4 * (y * size.x + x)]);
+				}
+			}
+			result.create(size.x, size.y, out.data());
+			return result;
+		}
+
+		// Premultiply, so that the color of transparent pixels does not bleed into their neighbors.
+		std::size_t const source_count = std::size_t{source_size.x} * source_size.y;
+		std::vector<float> premultiplied(4 * source_count);
+		for (std::size_t i = 0; i < source_count; ++i) {
+			float const alpha = pixels[4 * i + 3] / 255.f;
+			for (int channel = 0; channel < 3; ++channel) {
+				premultiplied[4 * i + channel] = pixels[4 * i + channel] / 255.f * alpha;
+			}
+			premultiplied[4 * i + 3] = alpha;
+		}
+
+		// Resample horizontally, then vertically.
+		std::vector<float> wide(4 * std::size_t{size.x} * source_size.y);
+		resample_axis(premultiplied,
+			1,
+			source_size.x,
+			source_size.y,
+			get_contributions(source_size.x, size.x, filter),
+			wide,
+			1,
+			size.x);
+		std::vector<float> resized(4 * std::size_t{size.x} * size.y);
+		resample_axis(wide, size.x, 1, size.x, get_contributions(source_size.y, size.y, filter), resized, size.x, 1);
+
+		// Unpremultiply, clamping away any ringing.
+		std::vector<sf::Uint8> out(resized.size());
+		for (std::size_t i = 0; i < resized.size(); i += 4) {
+			float const alpha = std::clamp(resized[i + 3], 0.f, 1.f);
+			for (int channel = 0; channel < 3; ++channel) {
+				float const value = alpha > 0 ? resized[i + channel] / alpha : 0;
+				out[i + channel] = static_cast<sf::Uint8>(std::clamp(value, 0.f, 1.f) * 255 + 0.5f);
+			}
+			out[i + 3] = static_cast<sf::Uint8>(alpha * 255 + 0.5f);
+		}
+		result.create(size.x, size.y, out.data());
+		return result;
+	}
+
+	auto resampled_key(std::string const& path, sf::Vector2u size, resample_filter filter) -> std::string {
+		return fmt::format("{}#{}x{} {}", path, size.x, size.y, to_string(filter));
+	}
+}
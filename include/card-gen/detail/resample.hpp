@@ -0,0 +1,42 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief High-quality image resampling.
+
+#pragma once
+
+#include <SFML/Graphics/Image.hpp>
+
+#include <string>
+
+namespace cg {
+	//! How an image element is resized to its on-card size.
+	enum class resample_filter {
+		//! Scale when drawing, sampling the nearest texel.
+		none,
+		//! Average the source pixels each output pixel covers. Fast, and sharp enough for downscaling.
+		box,
+		//! Three-lobed Lanczos windowed sinc. Sharpest, at some cost in ringing and time.
+		lanczos,
+	};
+
+	//! @throw std::domain_error if @p name is not "none", "box" or "lanczos".
+	auto parse_resample_filter(std::string const& name) -> resample_filter;
+
+	auto to_string(resample_filter filter) -> std::string;
+
+	//! The filter of image elements that do not specify one. Initially none.
+	auto get_default_resample_filter() -> resample_filter;
+	auto set_default_resample_filter(resample_filter filter) -> void;
+
+	//! Decodes the image file at @p path on the CPU, without a texture.
+	//! @throw std::runtime_error if the image could not be loaded.
+	auto load_image(std::string const& path) -> sf::Image;
+
+	//! Resizes @p source to @p size with @p filter, as two separable passes over premultiplied colors, so that
+	//! transparent pixels do not darken their neighbors. With the none filter, samples the nearest pixel.
+	auto resample(sf::Image const& source, sf::Vector2u size, resample_filter filter) -> sf::Image;
+
+	//! The key under which the image at @p path resampled to @p size with @p filter is cached. Keys derived from a
+	//! path start with the path followed by '#'.
+	auto resampled_key(std::string const& path, sf::Vector2u size, resample_filter filter) -> std::string;
+}
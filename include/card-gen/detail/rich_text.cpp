@@ -3,35 +3,23 @@
 
 #include "rich_text.hpp"
 
+#include "font_cache.hpp"
+#include "profiler.hpp"
+
 #include <SFML/Graphics.hpp>
 
 #include <fmt/format.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
 
 namespace {
-	struct format {
-		sf::Font* font = nullptr;
-		sf::Uint32 style_flags = sf::Text::Regular;
-		sf::Color fill_color = sf::Color::White;
-		sf::Color outline_color = sf::Color::White;
-		float outline_thickness = 0;
-	};
-
-	struct chunk {
-		format format;
-		sf::String text;
-	};
-
-	enum class align { left, center, right };
-
-	struct line {
-		std::vector<chunk> chunks;
-		align alignment = align::left;
-	};
-
-	std::map<std::string, sf::Font> _fonts;
-
+	std::shared_mutex _colors_mutex;
 	std::map<std::string, sf::Color> _colors = { //
 		{"default", sf::Color::White},
 		{"black", sf::Color::Black},
@@ -43,14 +31,180 @@ namespace {
 		{"white", sf::Color::White},
 		{"yellow", sf::Color::Yellow}};
 
+	std::atomic<bool> _default_batched = false;
+
+	// Appends an underline or strike-through quad, as sf::Text does.
+	auto add_line(sf::VertexArray& vertices,
+		sf::Vector2f offset,
+		float line_length,
+		float line_top,
+		sf::Color const& color,
+		float line_offset,
+		float thickness,
+		float outline_thickness = 0) -> void {
+		float const top = std::floor(line_top + line_offset - thickness / 2 + 0.5f);
+		float const bottom = top + std::floor(thickness + 0.5f);
+		float const left = offset.x - outline_thickness;
+		float const right = offset.x + line_length + outline_thickness;
+		// The font texture has a white square at (0, 0), for lines.
+		sf::Vector2f const tex_coords{1, 1};
+		vertices.append({{left, offset.y + top - outline_thickness}, color, tex_coords});
+		vertices.append({{right, offset.y + top - outline_thickness}, color, tex_coords});
+		vertices.append({{left, offset.y + bottom + outline_thickness}, color, tex_coords});
+		vertices.append({{left, offset.y + bottom + outline_thickness}, color, tex_coords});
+		vertices.append({{right, offset.y + top - outline_thickness}, color, tex_coords});
+		vertices.append({{right, offset.y + bottom + outline_thickness}, color, tex_coords});
+	}
+
+	// Appends a glyph quad, as sf::Text does.
+	auto add_glyph_quad(sf::VertexArray& vertices,
+		sf::Vector2f position,
+		sf::Color const& color,
+		sf::Glyph const& glyph,
+		float italic_shear,
+		float outline_thickness = 0) -> void {
+		float const padding = 1;
+		float const left = glyph.bounds.left - padding;
+		float const top = glyph.bounds.top - padding;
+		float const right = glyph.bounds.left + glyph.bounds.width + padding;
+		float const bottom = glyph.bounds.top + glyph.bounds.height + padding;
+
+		float const u1 = glyph.textureRect.left - padding;
+		float const v1 = glyph.textureRect.top - padding;
+		float const u2 = glyph.textureRect.left + glyph.textureRect.width + padding;
+		float const v2 = glyph.textureRect.top + glyph.textureRect.height + padding;
+
+		auto const vertex = [&](float x, float y, float u, float v) -> sf::Vertex {
+			return {{position.x + x - italic_shear * y - outline_thickness, position.y + y - outline_thickness},
+				color,
+				{u, v}};
+		};
+		vertices.append(vertex(left, top, u1, v1));
+		vertices.append(vertex(right, top, u2, v1));
+		vertices.append(vertex(left, bottom, u1, v2));
+		vertices.append(vertex(left, bottom, u1, v2));
+		vertices.append(vertex(right, top, u2, v1));
+		vertices.append(vertex(right, bottom, u2, v2));
+	}
+
+	// Appends the outline and fill geometry of a text to the given vertex arrays, matching sf::Text's own geometry
+	// (with default line and letter spacing) translated by the text's position.
+	auto append_text_geometry(sf::Text const& text, sf::VertexArray& outline_vertices, sf::VertexArray& fill_vertices)
+		-> void {
+		auto const& font = *text.getFont();
+		auto const& string = text.getString();
+		auto const character_size = text.getCharacterSize();
+		auto const style = text.getStyle();
+		auto const fill_color = text.getFillColor();
+		auto const outline_color = text.getOutlineColor();
+		auto const outline_thickness = text.getOutlineThickness();
+		auto const offset = text.getPosition();
+
+		bool const is_bold = style & sf::Text::Bold;
+		bool const is_underlined = style & sf::Text::Underlined;
+		bool const is_strike_through = style & sf::Text::StrikeThrough;
+		float const italic_shear = style & sf::Text::Italic ? 0.209f : 0.f; // 12 degrees in radians
+		float const underline_offset = font.getUnderlinePosition(character_size);
+		float const underline_thickness = font.getUnderlineThickness(character_size);
+		auto const x_bounds = font.getGlyph(U'x', character_size, is_bold).bounds;
+		float const strike_through_offset = x_bounds.top + x_bounds.height / 2;
+		float const whitespace_width = font.getGlyph(U' ', character_size, is_bold).advance;
+		float const line_spacing = font.getLineSpacing(character_size);
+
+		auto const add_lines = [&](float x, float y) {
+			if (is_underlined) {
+				add_line(fill_vertices, offset, x, y, fill_color, underline_offset, underline_thickness);
+				if (outline_thickness != 0) {
+					add_line(outline_vertices,
+						offset,
+						x,
+						y,
+						outline_color,
+						underline_offset,
+						underline_thickness,
+						outline_thickness);
+				}
+			}
+			if (is_strike_through) {
+				add_line(fill_vertices, offset, x, y, fill_color, strike_through_offset, underline_thickness);
+				if (outline_thickness != 0) {
+					add_line(outline_vertices,
+						offset,
+						x,
+						y,
+						outline_color,
+						strike_through_offset,
+						underline_thickness,
+						outline_thickness);
+				}
+			}
+		};
+
+		float x = 0;
+		float y = static_cast<float>(character_size);
+		sf::Uint32 prev_char = 0;
+		for (auto const cur_char : string) {
+			if (cur_char == U'\r') { continue; }
+			x += font.getKerning(prev_char, cur_char, character_size);
+			if (cur_char == U'\n' && prev_char != U'\n') { add_lines(x, y); }
+			prev_char = cur_char;
+			switch (cur_char) {
+				case U' ':
+					x += whitespace_width;
+					continue;
+				case U'\t':
+					x += whitespace_width * 4;
+					continue;
+				case U'\n':
+					y += line_spacing;
+					x = 0;
+					continue;
+			}
+			if (outline_thickness != 0) {
+				auto const& glyph = font.getGlyph(cur_char, character_size, is_bold, outline_thickness);
+				add_glyph_quad(outline_vertices,
+					offset + sf::Vector2f{x, y},
+					outline_color,
+					glyph,
+					italic_shear,
+					outline_thickness);
+			}
+			auto const& glyph = font.getGlyph(cur_char, character_size, is_bold);
+			add_glyph_quad(fill_vertices, offset + sf::Vector2f{x, y}, fill_color, glyph, italic_shear);
+			x += glyph.advance;
+		}
+		if (x > 0) { add_lines(x, y); }
+	}
+
+	// Whether the UTF-32 range [begin, end) equals the null-terminated ASCII string.
+	auto equals(sf::Uint32 const* begin, sf::Uint32 const* end, char const* ascii) -> bool {
+		for (; begin != end; ++begin, ++ascii) {
+			if (*ascii == '\0' || *begin != static_cast<unsigned char>(*ascii)) { return false; }
+		}
+		return *ascii == '\0';
+	}
+
+	// Assigns the UTF-32 range [begin, end) to out as an ANSI string. ASCII is narrowed directly, reusing the
+	// capacity of out.
+	auto assign_ansi(sf::Uint32 const* begin, sf::Uint32 const* end, std::string& out) -> void {
+		if (std::all_of(begin, end, [](sf::Uint32 c) { return c < 0x80; })) {
+			out.assign(begin, end);
+		} else {
+			out = sf::String::fromUtf32(begin, end).toAnsiString();
+		}
+	}
+
 	auto color_from_hex(unsigned argb_hex) -> sf::Color {
 		argb_hex |= 0xff000000;
 		return sf::Color(argb_hex >> 16 & 0xff, argb_hex >> 8 & 0xff, argb_hex >> 0 & 0xff, argb_hex >> 24 & 0xff);
 	}
 
 	auto color_from_string(std::string const& source) -> sf::Color {
-		auto result = _colors.find(source);
-		if (result != _colors.end()) { return result->second; }
+		{
+			std::shared_lock lock{_colors_mutex};
+			auto result = _colors.find(source);
+			if (result != _colors.end()) { return result->second; }
+		}
 		try {
 			return color_from_hex(std::stoi(source, 0, 16));
 		} catch (...) {
@@ -62,14 +216,47 @@ namespace {
 
 namespace sfe {
 	auto rich_text::add_color(sf::String const& name, sf::Color const& color) -> void {
+		std::unique_lock lock{_colors_mutex};
 		_colors[name] = color;
 	}
 
 	auto rich_text::add_color(sf::String const& name, unsigned argb_hex) -> void {
+		std::unique_lock lock{_colors_mutex};
 		_colors[name] = color_from_hex(argb_hex);
 	}
 
-	rich_text::rich_text(sf::String const& source, unsigned character_size) : _character_size(character_size) {
+	auto rich_text::referenced_fonts(sf::String const& source) -> std::vector<std::string> {
+		std::vector<std::string> result;
+		auto const source_end = source.getData() + source.getSize();
+		for (auto it = source.getData(); it != source_end; ++it) {
+			if (*it == '\\') {
+				// Skip the escaped character, if any.
+				if (++it == source_end) { break; }
+			} else if (*it == '[') {
+				auto const tag_end = std::find(it + 1, source_end, sf::Uint32{']'});
+				auto const command_end = std::find(it + 1, tag_end, sf::Uint32{' '});
+				if (equals(it + 1, command_end, "font")) {
+					std::string path;
+					assign_ansi(std::min(command_end + 1, tag_end), tag_end, path);
+					if (std::find(result.begin(), result.end(), path) == result.end()) { result.push_back(path); }
+				}
+				if (tag_end == source_end) { break; }
+				it = tag_end;
+			}
+		}
+		return result;
+	}
+
+	auto rich_text::set_default_batched(bool batched) -> void {
+		_default_batched = batched;
+	}
+
+	auto rich_text::is_default_batched() -> bool {
+		return _default_batched;
+	}
+
+	rich_text::rich_text(sf::String const& source, unsigned character_size)
+		: _batched(_default_batched), _character_size(character_size) {
 		set_source(source);
 	}
 
@@ -77,79 +264,80 @@ namespace sfe {
 		return _source;
 	}
 
-	auto rich_text::set_source(sf::String const& source) -> void {
-		_source = source;
+	auto rich_text::parse(sf::String const& source) -> std::vector<std::vector<span>> {
+		cg::scoped_timer const timer{"parse markup"};
+		// The current formatting, with no text.
+		span current_format;
+		std::vector<std::vector<span>> lines{{current_format}};
 
-		clear();
+		auto const apply_formatting = [&] {
+			if (!lines.back().back().text.empty()) {
+				// Start a new span if the current span has text.
+				lines.back().push_back(current_format);
+			} else {
+				// Otherwise, update current span.
+				lines.back().back() = current_format;
+			}
+		};
 
-		format current_format;
-		std::vector<line> lines{line{{chunk{current_format}}}};
-
-		for (auto it = source.begin(); it != source.end(); ++it) {
-			static auto apply_formatting = [&] {
-				if (!lines.back().chunks.back().text.isEmpty()) {
-					// Start a new chunk if the current chunk has text.
-					lines.back().chunks.push_back(chunk{current_format});
-				} else {
-					// Otherwise, update current chunk.
-					lines.back().chunks.back().format = current_format;
-				}
-			};
+		// Plain text is not copied character by character. Instead, the start of the pending run of plain text is
+		// tracked, and the whole run is appended to the current span when a control character ends it.
+		auto const source_begin = source.getData();
+		auto const source_end = source_begin + source.getSize();
+		auto text_begin = source_begin;
+		auto const flush_text = [&](sf::Uint32 const* text_end) {
+			lines.back().back().text.append(text_begin, text_end);
+		};
+
+		std::string arg;
+		for (auto it = source_begin; it != source_end; ++it) {
 			switch (*it) {
 				case '/': // Italic
+					flush_text(it);
 					current_format.style_flags ^= sf::Text::Italic;
 					apply_formatting();
 					break;
 				case '*': // Bold
+					flush_text(it);
 					current_format.style_flags ^= sf::Text::Bold;
 					apply_formatting();
 					break;
 				case '_': // Underline
+					flush_text(it);
 					current_format.style_flags ^= sf::Text::Underlined;
 					apply_formatting();
 					break;
 				case '~': // Strikethrough
+					flush_text(it);
 					current_format.style_flags ^= sf::Text::StrikeThrough;
 					apply_formatting();
 					break;
 				case '[': { // Tag
+					flush_text(it);
 					++it;
-					// Find the end of the tag and advance the iterator.
-					auto const tag_end = std::find(it, source.end(), sf::Uint32{']'});
-					if (tag_end == source.end()) { throw std::domain_error{"Missing ']' in tag."}; }
-					// Split into command and argument.
+					// Find the end of the tag.
+					auto const tag_end = std::find(it, source_end, sf::Uint32{']'});
+					if (tag_end == source_end) { throw std::domain_error{"Missing ']' in tag."}; }
+					// Split into command and argument. Commands are compared in place, without conversion.
 					auto const command_end = std::find(it, tag_end, sf::Uint32{' '});
-					auto const command = sf::String::fromUtf32(it, command_end);
-					auto const arg = sf::String::fromUtf32(command_end + 1, tag_end).toAnsiString();
+					auto const command = [&](char const* name) { return equals(it, command_end, name); };
+					assign_ansi(std::min(command_end + 1, tag_end), tag_end, arg);
 					// Handle the tag.
-					if (command == "fill-color") {
+					if (command("fill-color")) {
 						current_format.fill_color = color_from_string(arg);
 						apply_formatting();
-					} else if (command == "outline-color") {
+					} else if (command("outline-color")) {
 						current_format.outline_color = color_from_string(arg);
 						apply_formatting();
-					} else if (command == "outline-thickness") {
+					} else if (command("outline-thickness")) {
 						current_format.outline_thickness = std::stof(arg);
 						apply_formatting();
-					} else if (command == "font") {
-						// First = (font name, font) pair; second = whether insertion occurred.
-						auto result = _fonts.try_emplace(arg);
-						if (result.second) {
-							// Cache miss. Need to load font.
-							if (!result.first->second.loadFromFile(arg)) {
-								throw std::runtime_error{fmt::format("Could not load font from \"{}\".", arg)};
-							}
-						}
-						current_format.font = &result.first->second;
+					} else if (command("font")) {
+						current_format.font_path = arg;
 						apply_formatting();
-					} else if (command == "align") {
-						if (arg == "left") {
-							lines.back().alignment = align::left;
-						} else if (arg == "center") {
-							lines.back().alignment = align::center;
-						} else if (arg == "right") {
-							lines.back().alignment = align::right;
-						} else {
+					} else if (command("align")) {
+						//! @todo Align line.
+						if (arg != "left" && arg != "center" && arg != "right") {
 							throw std::domain_error{fmt::format("Invalid alignment: {}.", arg)};
 						}
 					}
@@ -159,8 +347,9 @@ namespace sfe {
 					break;
 				}
 				case '\\': // Escape sequence
+					flush_text(it);
 					++it;
-					if (it == source.end()) {
+					if (it == source_end) {
 						throw std::domain_error{"Expected formatting control character after '\\'."};
 					}
 					switch (*it) {
@@ -170,40 +359,54 @@ namespace sfe {
 						case '~':
 						case '[':
 						case '\\':
-							lines.back().chunks.back().text += *it;
-							break;
+							// The escaped character starts the next run of plain text.
+							text_begin = it;
+							continue;
 						default:
 							throw std::domain_error{
 								fmt::format("Cannot escape non-control character '{}'.", static_cast<char>(*it))};
 					}
-					break;
 				case '\n': // New line
-					lines.push_back(line{{chunk{current_format}}});
+					flush_text(it);
+					lines.push_back({current_format});
 					break;
 				default:
-					lines.back().chunks.back().text += *it;
-					break;
+					// Plain text; extend the pending run.
+					continue;
 			}
+			text_begin = it + 1;
 		}
+		flush_text(source_end);
+		return lines;
+	}
+
+	auto rich_text::set_source(sf::String const& source) -> void {
+		_source = source;
+
+		clear();
+
+		cg::scoped_timer const timer{"lay out text"};
+		auto const lines = parse(source);
 
 		// Build texts and formatting-stripped string and compute bounds.
 		sf::Vector2f next_position{};
 		_bounds = {0, 0, 0, 0};
 		for (auto const& line : lines) {
 			float line_spacing = 0;
-			for (auto const& chunk : line.chunks) {
+			for (auto const& span : line) {
 				// Construct text.
-				if (chunk.format.font == nullptr) { throw std::domain_error{"Text missing font specification."}; }
-				line_spacing = std::max(line_spacing, chunk.format.font->getLineSpacing(_character_size));
-				_texts.push_back({chunk.text, *chunk.format.font, _character_size});
-				_texts.back().setStyle(chunk.format.style_flags);
-				_texts.back().setFillColor(chunk.format.fill_color);
-				_texts.back().setOutlineColor(chunk.format.outline_color);
-				_texts.back().setOutlineThickness(chunk.format.outline_thickness);
+				if (span.font_path.empty()) { throw std::domain_error{"Text missing font specification."}; }
+				auto const& font = cg::font_cache::instance().get(span.font_path);
+				line_spacing = std::max(line_spacing, font.getLineSpacing(_character_size));
+				_texts.push_back({sf::String{span.text}, font, _character_size});
+				_texts.back().setStyle(span.style_flags);
+				_texts.back().setFillColor(span.fill_color);
+				_texts.back().setOutlineColor(span.outline_color);
+				_texts.back().setOutlineThickness(span.outline_thickness);
 				// Round next_position to avoid text blurriness.
 				_texts.back().setPosition(std::roundf(next_position.x), std::roundf(next_position.y));
 				// Move next position to the end of the text.
-				next_position = _texts.back().findCharacterPos(chunk.text.getSize());
+				next_position = _texts.back().findCharacterPos(span.text.size());
 				// Extend bounds.
 				auto const text_bounds = _texts.back().getGlobalBounds();
 				auto const right = text_bounds.left + text_bounds.width;
@@ -211,16 +414,18 @@ namespace sfe {
 				auto const bottom = text_bounds.top + text_bounds.height;
 				_bounds.height = std::max(_bounds.height, bottom - _bounds.top);
 			}
-			//! @todo Align line.
 			if (&line != &lines.back()) {
 				// Handle new lines.
 				next_position = {0, next_position.y + line_spacing};
 			}
 		}
+
+		if (_batched) { build_batches(); }
 	}
 
 	auto rich_text::clear() -> void {
 		_texts.clear();
+		_batches.clear();
 		_bounds = sf::FloatRect{};
 	}
 
@@ -241,10 +446,46 @@ namespace sfe {
 		return getTransform().transformRect(_bounds);
 	}
 
+	auto rich_text::is_batched() const -> bool {
+		return _batched;
+	}
+
+	auto rich_text::set_batched(bool batched) -> void {
+		_batched = batched;
+		_batches.clear();
+		if (_batched) { build_batches(); }
+	}
+
+	auto rich_text::build_batches() -> void {
+		for (auto const& text : _texts) {
+			auto const font = text.getFont();
+			auto batch_it = std::find_if(
+				_batches.begin(), _batches.end(), [&](batch const& batch) { return batch.font == font; });
+			if (batch_it == _batches.end()) {
+				_batches.push_back(batch{font});
+				batch_it = _batches.end() - 1;
+			}
+			append_text_geometry(text, batch_it->outline_vertices, batch_it->fill_vertices);
+		}
+	}
+
 	auto rich_text::draw(sf::RenderTarget& target, sf::RenderStates states) const -> void {
 		states.transform *= getTransform();
-		for (auto const& text : _texts) {
-			target.draw(text, states);
+		if (_batched) {
+			for (auto const& batch : _batches) {
+				// Look up the texture at draw time, since the font may have replaced it with a larger one. Texture
+				// coordinates are in pixels, so the vertices stay valid.
+				states.texture = &batch.font->getTexture(_character_size);
+				target.draw(batch.outline_vertices, states);
+				target.draw(batch.fill_vertices, states);
+			}
+			cg::count("draw calls", 2 * _batches.size());
+		} else {
+			for (auto const& text : _texts) {
+				target.draw(text, states);
+				// A text with an outline draws it in a second call.
+				cg::count("draw calls", text.getOutlineThickness() == 0 ? 1 : 2);
+			}
 		}
 	}
 }
@@ -7,8 +7,10 @@
 #include <SFML/Graphics/Color.hpp>
 #include <SFML/Graphics/Drawable.hpp>
 #include <SFML/Graphics/Text.hpp>
+#include <SFML/Graphics/VertexArray.hpp>
 #include <SFML/System/String.hpp>
 
+#include <string>
 #include <vector>
 
 namespace sfe {
@@ -16,10 +18,32 @@ namespace sfe {
 		: sf::Drawable
 		, sf::Transformable //
 	{
+		// A run of text with uniform formatting, as parsed from markup.
+		struct span {
+			std::string font_path;
+			sf::Uint32 style_flags = sf::Text::Regular;
+			sf::Color fill_color = sf::Color::White;
+			sf::Color outline_color = sf::Color::White;
+			float outline_thickness = 0;
+			std::basic_string<sf::Uint32> text;
+		};
+
 		// Set names for color substitutions (for example, ff0000 would be substituted for "red")
 		static auto add_color(sf::String const& name, sf::Color const& color) -> void;
 		static auto add_color(sf::String const& name, unsigned argb_hex) -> void;
 
+		// Get the paths of the fonts named by [font] tags in the given markup, without duplicates.
+		static auto referenced_fonts(sf::String const& source) -> std::vector<std::string>;
+
+		// Parse the given markup into lines of spans, without loading fonts or laying out text, so that it can also be
+		// rendered without SFML's text drawing. Each line has at least one span.
+		static auto parse(sf::String const& source) -> std::vector<std::vector<span>>;
+
+		// Set whether newly constructed rich texts are batched (see set_batched).
+		static auto set_default_batched(bool batched) -> void;
+		// Get whether newly constructed rich texts are batched.
+		static auto is_default_batched() -> bool;
+
 		rich_text(sf::String const& source, unsigned character_size = 30);
 
 		auto get_source() const -> sf::String;
@@ -32,10 +56,26 @@ namespace sfe {
 		auto get_local_bounds() const -> sf::FloatRect;
 		auto get_global_bounds() const -> sf::FloatRect;
 
+		// When batched, chunks that share a font are merged into one outline and one fill vertex array, so the text is
+		// drawn in two draw calls per font instead of up to two per chunk. Fonts are drawn in order of first use, each
+		// with its outline pass before its fill pass.
+		auto is_batched() const -> bool;
+		auto set_batched(bool batched) -> void;
+
 	private:
+		struct batch {
+			sf::Font const* font;
+			sf::VertexArray outline_vertices{sf::Triangles};
+			sf::VertexArray fill_vertices{sf::Triangles};
+		};
+
 		auto draw(sf::RenderTarget& target, sf::RenderStates states) const -> void;
 
+		auto build_batches() -> void;
+
 		std::vector<sf::Text> _texts;
+		std::vector<batch> _batches;
+		bool _batched;
 
 		unsigned _character_size;
 
@@ -0,0 +1,479 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+
+#include "software_renderer.hpp"
+
+#include "../card-gen.hpp"
+#include "font_cache.hpp"
+#include "lru_cache.hpp"
+#include "mapped_file.hpp"
+#include "resample.hpp"
+#include "rich_text.hpp"
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_BITMAP_H
+#include FT_GLYPH_H
+#include FT_OUTLINE_H
+#include FT_STROKER_H
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace cg {
+	namespace {
+		//! Decoded and resampled images, shared by all threads' renderers, keyed like texture_cache.
+		auto get_images() -> lru_cache<sf::Image>& {
+			static lru_cache<sf::Image> result{{"image cache hits", "image cache misses", "load image"},
+				software_renderer::default_image_capacity};
+			return result;
+		}
+
+		//! Gets the image cached under @p key, calling @p make to create it on a cache miss.
+		template <typename F>
+		auto get_image(std::string const& key, F const& make) -> std::shared_ptr<sf::Image const> {
+			return get_images().get(key, [&] { return std::make_shared<sf::Image const>(make()); });
+		}
+
+		//! Converts from FreeType's 26.6 fixed-point format.
+		auto from_26_6(FT_Pos value) -> float {
+			return static_cast<float>(value) / static_cast<float>(1 << 6);
+		}
+
+		//! The index of the first pixel whose center is at or after @p edge.
+		auto first_pixel(float edge) -> int {
+			return static_cast<int>(std::ceil(edge - 0.5f));
+		}
+
+		//! An RGBA image being drawn, which blends the way an sf::RenderTexture does with sf::BlendAlpha.
+		struct canvas {
+			int width;
+			int height;
+			std::vector<sf::Uint8> pixels;
+
+			//! Creates an opaque black canvas, like a cleared render texture.
+			canvas(sf::Vector2i size)
+				: width{std::max(size.x, 0)}, height{std::max(size.y, 0)}, pixels(std::size_t{4} * width * height) {
+				for (std::size_t i = 3; i < pixels.size(); i += 4) {
+					pixels[i] = 255;
+				}
+			}
+
+			//! Blends @p count pixels of @p color, starting at (@p x, @p y), weighted by the corresponding values of
+			//! @p coverage. The pixels must be in bounds.
+			//! @note Straight-line integer arithmetic over contiguous rows, so that compilers can vectorize it.
+			auto blend_row(int x, int y, sf::Color color, sf::Uint8 const* coverage, int count) -> void {
+				auto dst = pixels.data() + 4 * (std::size_t(y) * width + x);
+				for (int i = 0; i < count; ++i, dst += 4) {
+					unsigned const a = (unsigned{color.a} * coverage[i] + 127) / 255;
+					unsigned const inverse = 255 - a;
+					dst[0] = static_cast<sf::Uint8>((color.r * a + dst[0] * inverse + 127) / 255);
+					dst[1] = static_cast<sf::Uint8>((color.g * a + dst[1] * inverse + 127) / 255);
+					dst[2] = static_cast<sf::Uint8>((color.b * a + dst[2] * inverse + 127) / 255);
+					dst[3] = static_cast<sf::Uint8>(a + (dst[3] * inverse + 127) / 255);
+				}
+			}
+
+			//! Blends the @p count source pixels at @p src, in RGBA order, starting at (@p x, @p y). The pixels must be
+			//! in bounds.
+			auto blend_pixels(int x, int y, sf::Uint8 const* src, int count) -> void {
+				auto dst = pixels.data() + 4 * (std::size_t(y) * width + x);
+				for (int i = 0; i < count; ++i, dst += 4, src += 4) {
+					unsigned const a = src[3];
+					unsigned const inverse = 255 - a;
+					dst[0] = static_cast<sf::Uint8>((src[0] * a + dst[0] * inverse + 127) / 255);
+					dst[1] = static_cast<sf::Uint8>((src[1] * a + dst[1] * inverse + 127) / 255);
+					dst[2] = static_cast<sf::Uint8>((src[2] * a + dst[2] * inverse + 127) / 255);
+					dst[3] = static_cast<sf::Uint8>(a + (dst[3] * inverse + 127) / 255);
+				}
+			}
+
+			//! Blends @p color over the pixels whose centers are in the given rectangle, as OpenGL rasterizes a quad.
+			auto fill_rect(float left, float top, float right, float bottom, sf::Color color) -> void {
+				int const x0 = std::max(first_pixel(left), 0);
+				int const x1 = std::min(first_pixel(right), width);
+				int const y0 = std::max(first_pixel(top), 0);
+				int const y1 = std::min(first_pixel(bottom), height);
+				if (x0 >= x1) { return; }
+				std::vector<sf::Uint8> const coverage(x1 - x0, 255);
+				for (int y = y0; y < y1; ++y) {
+					blend_row(x0, y, color, coverage.data(), x1 - x0);
+				}
+			}
+
+			//! Draws @p image scaled by @p scale with its top-left corner at @p position, sampling the nearest texel
+			//! as a non-smooth texture does.
+			auto draw_image(sf::Image const& image, sf::Vector2f position, sf::Vector2f scale) -> void {
+				auto const image_size = image.getSize();
+				if (image_size.x == 0 || image_size.y == 0 || scale.x == 0 || scale.y == 0) { return; }
+				auto const far_x = position.x + image_size.x * scale.x;
+				auto const far_y = position.y + image_size.y * scale.y;
+				int const x0 = std::max(first_pixel(std::min(position.x, far_x)), 0);
+				int const x1 = std::min(first_pixel(std::max(position.x, far_x)), width);
+				int const y0 = std::max(first_pixel(std::min(position.y, far_y)), 0);
+				int const y1 = std::min(first_pixel(std::max(position.y, far_y)), height);
+				if (x0 >= x1) { return; }
+
+				auto const texel = [](float pixel_center, float start, float scale, unsigned size) {
+					auto const index = static_cast<int>(std::floor((pixel_center - start) / scale));
+					return static_cast<unsigned>(std::clamp(index, 0, static_cast<int>(size) - 1));
+				};
+				// Every row samples the same columns. Gather each row's texels into a contiguous buffer, then blend the
+				// whole row at once.
+				std::vector<unsigned> columns(x1 - x0);
+				for (int x = x0; x < x1; ++x) {
+					columns[x - x0] = texel(x + 0.5f, position.x, scale.x, image_size.x);
+				}
+				std::vector<sf::Uint8> row(std::size_t{4} * columns.size());
+				auto const src = image.getPixelsPtr();
+				for (int y = y0; y < y1; ++y) {
+					auto const src_y = texel(y + 0.5f, position.y, scale.y, image_size.y);
+					auto const src_row = src + std::size_t{4} * image_size.x * src_y;
+					for (std::size_t i = 0; i < columns.size(); ++i) {
+						std::memcpy(&row[4 * i], src_row + std::size_t{4} * columns[i], 4);
+					}
+					blend_pixels(x0, y, row.data(), x1 - x0);
+				}
+			}
+
+			auto to_image() const -> sf::Image {
+				sf::Image result;
+				result.create(width, height, pixels.data());
+				return result;
+			}
+		};
+
+		//! A rasterized glyph, with metrics computed as sf::Font computes them.
+		struct glyph {
+			float advance = 0;
+			//! The glyph's bounds relative to the pen position.
+			sf::FloatRect bounds;
+			//! Size of the bitmap, which is placed at the top-left corner of the bounds.
+			int width = 0;
+			int height = 0;
+			//! Coverage values, row by row.
+			std::vector<sf::Uint8> coverage;
+		};
+
+		//! A FreeType face over a font file mapped by the font cache.
+		struct face {
+			std::shared_ptr<mapped_file const> file;
+			FT_Face ft_face = nullptr;
+			unsigned current_size = 0;
+			//! Glyphs by character size, code point, boldness and outline thickness.
+			std::map<std::tuple<unsigned, sf::Uint32, bool, float>, glyph> glyphs;
+
+			~face() {
+				if (ft_face) { FT_Done_Face(ft_face); }
+			}
+
+			auto set_size(unsigned size) -> void {
+				if (size != current_size && FT_Set_Pixel_Sizes(ft_face, 0, size) == 0) { current_size = size; }
+			}
+
+			auto get_line_spacing(unsigned size) -> float {
+				set_size(size);
+				return from_26_6(ft_face->size->metrics.height);
+			}
+
+			auto get_kerning(sf::Uint32 first, sf::Uint32 second, unsigned size) -> float {
+				if (first == 0 || second == 0 || !FT_HAS_KERNING(ft_face)) { return 0; }
+				set_size(size);
+				FT_Vector kerning;
+				FT_Get_Kerning(ft_face,
+					FT_Get_Char_Index(ft_face, first),
+					FT_Get_Char_Index(ft_face, second),
+					FT_KERNING_DEFAULT,
+					&kerning);
+				return FT_IS_SCALABLE(ft_face) ? from_26_6(kerning.x) : static_cast<float>(kerning.x);
+			}
+
+			auto get_underline_position(unsigned size) -> float {
+				set_size(size);
+				if (!FT_IS_SCALABLE(ft_face)) { return size / 10.f; }
+				return -from_26_6(FT_MulFix(ft_face->underline_position, ft_face->size->metrics.y_scale));
+			}
+
+			auto get_underline_thickness(unsigned size) -> float {
+				set_size(size);
+				if (!FT_IS_SCALABLE(ft_face)) { return size / 14.f; }
+				return from_26_6(FT_MulFix(ft_face->underline_thickness, ft_face->size->metrics.y_scale));
+			}
+		};
+	}
+
+	struct software_renderer::impl {
+		FT_Library library = nullptr;
+		FT_Stroker stroker = nullptr;
+		std::unordered_map<std::string, std::unique_ptr<face>> faces;
+
+		impl() {
+			if (FT_Init_FreeType(&library) != 0) { throw std::runtime_error{"Could not initialize FreeType."}; }
+			if (FT_Stroker_New(library, &stroker) != 0) {
+				FT_Done_FreeType(library);
+				throw std::runtime_error{"Could not create FreeType stroker."};
+			}
+		}
+
+		~impl() {
+			// Faces must be destroyed before their library.
+			faces.clear();
+			FT_Stroker_Done(stroker);
+			FT_Done_FreeType(library);
+		}
+
+		//! Gets the face for the font at @p path, reloading it if the font cache has remapped the file.
+		auto get_face(std::string const& path) -> face& {
+			auto file = font_cache::instance().get_file(path);
+			auto& result = faces[path];
+			if (result && result->file == file) { return *result; }
+
+			result = std::make_unique<face>();
+			result->file = std::move(file);
+			if (FT_New_Memory_Face(library,
+					static_cast<FT_Byte const*>(result->file->data()),
+					static_cast<FT_Long>(result->file->size()),
+					0,
+					&result->ft_face) != 0 ||
+				FT_Select_Charmap(result->ft_face, FT_ENCODING_UNICODE) != 0) {
+				faces.erase(path);
+				throw std::runtime_error{fmt::format("Could not load font from \"{}\".", path)};
+			}
+			return *result;
+		}
+
+		//! Gets a glyph, rasterizing it like sf::Font::getGlyph on first use.
+		auto get_glyph(face& f, sf::Uint32 code_point, unsigned size, bool bold, float outline_thickness)
+			-> glyph const& {
+			auto const result = f.glyphs.try_emplace({size, code_point, bold, outline_thickness});
+			if (result.second) {
+				count("glyphs rasterized");
+				result.first->second = rasterize(f, code_point, size, bold, outline_thickness);
+			}
+			return result.first->second;
+		}
+
+		//! The position just past the end of @p span relative to its start and the bottom-right corner of its bounds,
+		//! as sf::Text::findCharacterPos and sf::Text::getLocalBounds compute them.
+		auto measure(face& f, sfe::rich_text::span const& span, unsigned size) -> std::pair<float, sf::Vector2f> {
+			bool const is_bold = span.style_flags & sf::Text::Bold;
+			float const italic_shear = span.style_flags & sf::Text::Italic ? 0.209f : 0.f;
+			float const outline = span.outline_thickness;
+			float const whitespace_width = get_glyph(f, U' ', size, is_bold, 0).advance;
+			float x = 0;
+			float const y = static_cast<float>(size);
+			sf::Vector2f bottom_right{};
+			sf::Uint32 prev_char = 0;
+			for (auto const cur_char : span.text) {
+				x += f.get_kerning(prev_char, cur_char, size);
+				prev_char = cur_char;
+				if (cur_char == U' ' || cur_char == U'\t') {
+					x += cur_char == U' ' ? whitespace_width : whitespace_width * 4;
+					bottom_right = {std::max(bottom_right.x, x), std::max(bottom_right.y, y)};
+					continue;
+				}
+				if (cur_char != U'\r') {
+					// sf::Text takes the bounds of the outline glyph if there is an outline.
+					auto const& bounds = get_glyph(f, cur_char, size, is_bold, outline).bounds;
+					bottom_right.x =
+						std::max(bottom_right.x, x + bounds.left + bounds.width - italic_shear * bounds.top - outline);
+					bottom_right.y = std::max(bottom_right.y, y + bounds.top + bounds.height - outline);
+				}
+				x += get_glyph(f, cur_char, size, is_bold, 0).advance;
+			}
+			return {x, bottom_right};
+		}
+
+		//! Draws @p span onto @p target with its top-left corner at @p position, as sf::Text draws it: its outline,
+		//! if any, then its fill.
+		auto draw_span(canvas& target, face& f, sfe::rich_text::span const& span, unsigned size, sf::Vector2f position)
+			-> void {
+			bool const is_bold = span.style_flags & sf::Text::Bold;
+			bool const is_underlined = span.style_flags & sf::Text::Underlined;
+			bool const is_strike_through = span.style_flags & sf::Text::StrikeThrough;
+			float const italic_shear = span.style_flags & sf::Text::Italic ? 0.209f : 0.f; // 12 degrees in radians
+			float const underline_offset = f.get_underline_position(size);
+			float const underline_thickness = f.get_underline_thickness(size);
+			auto const x_bounds = get_glyph(f, U'x', size, is_bold, 0).bounds;
+			float const strike_through_offset = x_bounds.top + x_bounds.height / 2;
+			float const whitespace_width = get_glyph(f, U' ', size, is_bold, 0).advance;
+			float const baseline = position.y + size;
+
+			auto const draw_pass = [&](sf::Color color, float outline) {
+				auto const draw_line = [&](float length, float line_offset) {
+					float const top = std::floor(baseline + line_offset - underline_thickness / 2 + 0.5f);
+					float const bottom = top + std::floor(underline_thickness + 0.5f);
+					target.fill_rect(
+						position.x - outline, top - outline, position.x + length + outline, bottom + outline, color);
+				};
+				float x = 0;
+				sf::Uint32 prev_char = 0;
+				for (auto const cur_char : span.text) {
+					if (cur_char == U'\r') { continue; }
+					x += f.get_kerning(prev_char, cur_char, size);
+					prev_char = cur_char;
+					if (cur_char == U' ' || cur_char == U'\t') {
+						x += cur_char == U' ' ? whitespace_width : whitespace_width * 4;
+						continue;
+					}
+					auto const& g = get_glyph(f, cur_char, size, is_bold, outline);
+					float const left = position.x + x + g.bounds.left - outline;
+					float const top = baseline + g.bounds.top - outline;
+					for (int row = 0; row < g.height; ++row) {
+						// Each texel goes to the pixel containing its center.
+						int const y = static_cast<int>(std::floor(top + row + 0.5f));
+						if (y < 0 || y >= target.height) { continue; }
+						// Shear italics row by row, about the baseline.
+						float const shear = italic_shear * (g.bounds.top + row + 0.5f);
+						int const x0 = static_cast<int>(std::floor(left - shear + 0.5f));
+						int const begin = std::max(0, -x0);
+						int const end = std::min(g.width, target.width - x0);
+						if (begin >= end) { continue; }
+						auto const coverage = g.coverage.data() + std::size_t(row) * g.width;
+						target.blend_row(x0 + begin, y, color, coverage + begin, end - begin);
+					}
+					x += get_glyph(f, cur_char, size, is_bold, 0).advance;
+				}
+				if (x > 0) {
+					if (is_underlined) { draw_line(x, underline_offset); }
+					if (is_strike_through) { draw_line(x, strike_through_offset); }
+				}
+			};
+			if (span.outline_thickness != 0) { draw_pass(span.outline_color, span.outline_thickness); }
+			draw_pass(span.fill_color, 0);
+		}
+
+	private:
+		auto rasterize(face& f, sf::Uint32 code_point, unsigned size, bool bold, float outline_thickness) -> glyph {
+			glyph result;
+			f.set_size(size);
+			FT_Int32 flags = FT_LOAD_TARGET_NORMAL | FT_LOAD_FORCE_AUTOHINT;
+			if (outline_thickness != 0) { flags |= FT_LOAD_NO_BITMAP; }
+			if (FT_Load_Char(f.ft_face, code_point, flags) != 0) { return result; }
+			FT_Glyph ft_glyph;
+			if (FT_Get_Glyph(f.ft_face->glyph, &ft_glyph) != 0) { return result; }
+
+			FT_Pos const weight = 1 << 6;
+			bool const is_outline = ft_glyph->format == FT_GLYPH_FORMAT_OUTLINE;
+			if (is_outline) {
+				if (bold) { FT_Outline_Embolden(&reinterpret_cast<FT_OutlineGlyph>(ft_glyph)->outline, weight); }
+				if (outline_thickness != 0) {
+					FT_Stroker_Set(stroker,
+						static_cast<FT_Fixed>(outline_thickness * static_cast<float>(1 << 6)),
+						FT_STROKER_LINECAP_ROUND,
+						FT_STROKER_LINEJOIN_ROUND,
+						0);
+					FT_Glyph_Stroke(&ft_glyph, stroker, true);
+				}
+			}
+			FT_Glyph_To_Bitmap(&ft_glyph, FT_RENDER_MODE_NORMAL, nullptr, true);
+			auto& bitmap = reinterpret_cast<FT_BitmapGlyph>(ft_glyph)->bitmap;
+			if (!is_outline && bold) { FT_Bitmap_Embolden(library, &bitmap, weight, weight); }
+
+			auto const& metrics = f.ft_face->glyph->metrics;
+			result.advance = from_26_6(metrics.horiAdvance) + (bold ? from_26_6(weight) : 0);
+			result.bounds.left = from_26_6(metrics.horiBearingX);
+			result.bounds.top = -from_26_6(metrics.horiBearingY);
+			result.bounds.width = from_26_6(metrics.width) + outline_thickness * 2;
+			result.bounds.height = from_26_6(metrics.height) + outline_thickness * 2;
+			result.width = static_cast<int>(bitmap.width);
+			result.height = static_cast<int>(bitmap.rows);
+			result.coverage.resize(std::size_t(result.width) * result.height);
+			auto const pitch = bitmap.pitch;
+			for (int y = 0; y < result.height; ++y) {
+				auto const src_row = bitmap.buffer + static_cast<std::ptrdiff_t>(y) * pitch;
+				auto const dst_row = result.coverage.data() + std::size_t(y) * result.width;
+				for (int x = 0; x < result.width; ++x) {
+					dst_row[x] = bitmap.pixel_mode == FT_PIXEL_MODE_MONO //
+						? ((src_row[x / 8] & (1 << (7 - x % 8))) ? 255 : 0)
+						: src_row[x];
+				}
+			}
+			FT_Done_Glyph(ft_glyph);
+			return result;
+		}
+	};
+
+	auto software_renderer::local() -> software_renderer& {
+		thread_local software_renderer result;
+		return result;
+	}
+
+	auto software_renderer::erase_image(std::string const& path) -> void {
+		get_images().erase(path);
+	}
+
+	auto software_renderer::set_image_capacity(std::size_t capacity) -> void {
+		get_images().set_capacity(capacity);
+	}
+
+	software_renderer::software_renderer() : _impl{std::make_unique<impl>()} {}
+
+	software_renderer::~software_renderer() = default;
+
+	auto software_renderer::render_image(card const& c) -> sf::Image {
+		scoped_timer const timer{"render card in software"};
+		canvas target{c.size};
+		for (auto const& element : c.elements) {
+			// Positions and origins are rounded as in compiled_card.
+			sf::Vector2f const rounded_pos{
+				std::roundf(c.size.x * element.pos.x), std::roundf(c.size.y * element.pos.y)};
+			match(
+				element.text_or_image,
+				[&](text const& t) {
+					// Lay out spans as rich_text does, then draw them relative to the text's origin.
+					auto const lines = sfe::rich_text::parse(t.markup);
+					// Each span and its face, with its position relative to the text's top-left corner.
+					std::vector<std::tuple<sfe::rich_text::span const*, face*, sf::Vector2f>> spans;
+					sf::Vector2f next_position{};
+					sf::Vector2f bounds{};
+					for (auto const& line : lines) {
+						float line_spacing = 0;
+						for (auto const& span : line) {
+							if (span.font_path.empty()) {
+								throw std::domain_error{"Text missing font specification."};
+							}
+							auto& f = _impl->get_face(span.font_path);
+							line_spacing = std::max(line_spacing, f.get_line_spacing(t.size));
+							sf::Vector2f const position{std::roundf(next_position.x), std::roundf(next_position.y)};
+							spans.emplace_back(&span, &f, position);
+							auto const [end_x, bottom_right] = _impl->measure(f, span, t.size);
+							next_position = {position.x + end_x, position.y};
+							bounds.x = std::max(bounds.x, position.x + bottom_right.x);
+							bounds.y = std::max(bounds.y, position.y + bottom_right.y);
+						}
+						if (&line != &lines.back()) { next_position = {0, next_position.y + line_spacing}; }
+					}
+					sf::Vector2f const origin{
+						std::roundf(bounds.x * element.origin.x), std::roundf(bounds.y * element.origin.y)};
+					for (auto const& [span, f, position] : spans) {
+						_impl->draw_span(target, *f, *span, t.size, rounded_pos - origin + position);
+					}
+				},
+				[&](image const& i) {
+					auto const filter = i.filter.value_or(get_default_resample_filter());
+					auto const source = filter == resample_filter::none
+						? get_image(i.path, [&] { return load_image(i.path); })
+						: get_image(resampled_key(i.path, i.get_pixel_size(c.size), filter),
+							  [&] { return resample(load_image(i.path), i.get_pixel_size(c.size), filter); });
+					auto const source_size = source->getSize();
+					if (source_size.x == 0 || source_size.y == 0) { return; }
+					sf::Vector2f const scale{
+						i.size.x * c.size.x / source_size.x, i.size.y * c.size.y / source_size.y};
+					sf::Vector2f const origin{
+						std::roundf(source_size.x * element.origin.x), std::roundf(source_size.y * element.origin.y)};
+					sf::Vector2f const top_left{rounded_pos.x - origin.x * scale.x, rounded_pos.y - origin.y * scale.y};
+					target.draw_image(*source, top_left, scale);
+				});
+		}
+		return target.to_image();
+	}
+}
@@ -0,0 +1,52 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Rendering of cards on the CPU, without OpenGL.
+
+#pragma once
+
+#include <SFML/Graphics/Image.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace cg {
+	struct card;
+
+	//! Renders cards entirely on the CPU, so that no OpenGL context is needed. Images are decoded once per process,
+	//! cached under a memory cap like textures, and sampled like non-smooth textures, and glyphs are rasterized with
+	//! FreeType the way sf::Font rasterizes them and laid out the way sf::Text lays them out. The result closely
+	//! matches the OpenGL renderer but is not guaranteed to be identical, since glyphs are blitted unfiltered rather
+	//! than sampled.
+	struct software_renderer {
+		//! Default limit on the approximate total size of cached images, in bytes.
+		static constexpr std::size_t default_image_capacity = 256 * 1024 * 1024;
+
+		//! The calling thread's renderer. FreeType faces are not thread-safe, so each thread has its own faces and
+		//! glyph cache.
+		static auto local() -> software_renderer&;
+
+		//! Forgets the decoded image at @p path and its resampled versions, shared by all threads' renderers, so that
+		//! it is loaded again from disk on next use.
+		static auto erase_image(std::string const& path) -> void;
+
+		//! Sets the memory cap of the decoded images shared by all threads' renderers, evicting least-recently-used
+		//! images as needed.
+		static auto set_image_capacity(std::size_t capacity) -> void;
+
+		software_renderer();
+		~software_renderer();
+
+		software_renderer(software_renderer const&) = delete;
+		auto operator=(software_renderer const&) -> software_renderer& = delete;
+
+		//! Renders @p c to an image in memory.
+		//! @throw std::runtime_error if a font or image could not be loaded.
+		//! @throw std::domain_error if the card's text markup is invalid.
+		auto render_image(card const& c) -> sf::Image;
+
+	private:
+		struct impl;
+		std::unique_ptr<impl> _impl;
+	};
+}
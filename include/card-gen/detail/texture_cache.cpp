@@ -0,0 +1,74 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+
+#include "texture_cache.hpp"
+
+#include "mapped_file.hpp"
+
+#include <fmt/format.h>
+
+#include <optional>
+#include <stdexcept>
+
+namespace cg {
+	auto texture_cache::instance() -> texture_cache& {
+		static texture_cache result;
+		return result;
+	}
+
+	texture_cache::texture_cache(std::size_t capacity)
+		: _textures{{"texture cache hits", "texture cache misses", "load texture"}, capacity} {}
+
+	auto texture_cache::get(std::string const& path) -> std::shared_ptr<sf::Texture const> {
+		return get(path, [&](sf::Texture& texture) {
+			// Decode straight from the page cache. The mapping is only needed until the image is decoded.
+			std::optional<mapped_file> file;
+			try {
+				file.emplace(path);
+			} catch (std::runtime_error const&) {
+				throw std::runtime_error{fmt::format("Could not load image from \"{}\".", path)};
+			}
+			if (!texture.loadFromMemory(file->data(), file->size())) {
+				throw std::runtime_error{fmt::format("Could not load image from \"{}\".", path)};
+			}
+		});
+	}
+
+	auto texture_cache::get(std::string const& path, sf::Vector2u size, resample_filter filter)
+		-> std::shared_ptr<sf::Texture const> {
+		return get(resampled_key(path, size, filter), [&](sf::Texture& texture) {
+			if (!texture.loadFromImage(resample(load_image(path), size, filter))) {
+				throw std::runtime_error{fmt::format("Could not create resampled texture for \"{}\".", path)};
+			}
+		});
+	}
+
+	auto texture_cache::get(std::string const& key, std::function<void(sf::Texture&)> const& make)
+		-> std::shared_ptr<sf::Texture const> {
+		return _textures.get(key, [&] {
+			auto texture = std::make_shared<sf::Texture>();
+			make(*texture);
+			return std::shared_ptr<sf::Texture const>{std::move(texture)};
+		});
+	}
+
+	auto texture_cache::get_capacity() const -> std::size_t {
+		return _textures.get_capacity();
+	}
+
+	auto texture_cache::set_capacity(std::size_t capacity) -> void {
+		_textures.set_capacity(capacity);
+	}
+
+	auto texture_cache::get_size() const -> std::size_t {
+		return _textures.get_size();
+	}
+
+	auto texture_cache::erase(std::string const& key) -> void {
+		_textures.erase(key);
+	}
+
+	auto texture_cache::clear() -> void {
+		_textures.clear();
+	}
+}
@@ -0,0 +1,61 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Thread-safe keyed cache of image textures with a memory cap and least-recently-used eviction.
+
+#pragma once
+
+#include "lru_cache.hpp"
+#include "resample.hpp"
+
+#include <SFML/Graphics/Texture.hpp>
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace cg {
+	struct texture_cache {
+		//! Default limit on the approximate total size of cached textures, in bytes.
+		static constexpr std::size_t default_capacity = 256 * 1024 * 1024;
+
+		//! The process-wide texture cache used by card rendering.
+		static auto instance() -> texture_cache&;
+
+		texture_cache(std::size_t capacity = default_capacity);
+
+		//! Gets the texture for the image at @p path, loading it on a cache miss.
+		//! @note The returned texture remains valid even if it is later evicted from the cache.
+		//! @throw std::runtime_error if the image could not be loaded.
+		auto get(std::string const& path) -> std::shared_ptr<sf::Texture const>;
+
+		//! Gets the texture for the image at @p path resized to @p size with @p filter, resampling it on a cache miss.
+		//! @note The returned texture remains valid even if it is later evicted from the cache.
+		//! @throw std::runtime_error if the image could not be loaded.
+		auto get(std::string const& path, sf::Vector2u size, resample_filter filter)
+			-> std::shared_ptr<sf::Texture const>;
+
+		//! Gets the texture cached under @p key. On a cache miss, @p make is called to fill in a new texture, without
+		//! blocking threads that get other textures.
+		//! @note The returned texture remains valid even if it is later evicted from the cache.
+		//! @note Textures are not copied, since copying an sf::Texture copies its contents on the GPU.
+		auto get(std::string const& key, std::function<void(sf::Texture&)> const& make)
+			-> std::shared_ptr<sf::Texture const>;
+
+		auto get_capacity() const -> std::size_t;
+		//! Sets the memory cap, evicting least-recently-used textures as needed.
+		auto set_capacity(std::size_t capacity) -> void;
+
+		//! The approximate total size of cached textures, in bytes.
+		auto get_size() const -> std::size_t;
+
+		//! Removes the texture cached under @p key, if any, and the textures derived from it (see resampled_key), so
+		//! that they are made again on next use.
+		auto erase(std::string const& key) -> void;
+
+		auto clear() -> void;
+
+	private:
+		lru_cache<sf::Texture> _textures;
+	};
+}
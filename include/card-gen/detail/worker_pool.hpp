@@ -0,0 +1,47 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Minimal worker pool for spreading independent tasks across threads.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cg {
+	//! Calls @p f with each index in [0, @p count), spreading the calls across up to @p thread_count threads. The
+	//! calling thread is one of the workers. Indices are handed out in increasing order as workers become free.
+	//! @throw The first exception thrown by @p f, once all workers have stopped. No further indices are handed out
+	//! after a call throws.
+	template <typename F>
+	auto parallel_for(std::size_t count, unsigned thread_count, F&& f) -> void {
+		std::atomic<std::size_t> next{0};
+		std::mutex error_mutex;
+		std::exception_ptr error;
+		auto const work = [&] {
+			for (auto i = next++; i < count; i = next++) {
+				try {
+					f(i);
+				} catch (...) {
+					std::lock_guard lock{error_mutex};
+					if (!error) { error = std::current_exception(); }
+					next = count;
+				}
+			}
+		};
+		auto const worker_count = std::max<std::size_t>(1, std::min<std::size_t>(thread_count, count));
+		std::vector<std::thread> threads;
+		for (std::size_t t = 1; t < worker_count; ++t) {
+			threads.emplace_back(work);
+		}
+		work();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+		if (error) { std::rethrow_exception(error); }
+	}
+}
@@ -0,0 +1,182 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Incremental rebuilds: skipping cards whose specification and assets are unchanged.
+
+#pragma once
+
+#include "backend.hpp"
+#include "card-gen.hpp"
+#include "detail/hash.hpp"
+
+#include <fmt/format.h>
+#include <nlohmann/json.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cg {
+	//! Content hashes of asset files, such as fonts and images. Each hash is remembered with the size and modification
+	//! time of the file it was computed from, and a file is read again only once either changes. Hashing contents
+	//! rather than modification times keeps build hashes the same on every node that has the same assets, e.g. after
+	//! a checkout or copy that does not preserve modification times.
+	//! @note Not thread-safe.
+	struct asset_hash_cache {
+		//! Hashes the contents of the file at @p path.
+		//! @return The hash, or std::nullopt if the file cannot be read.
+		auto get(std::string const& path) -> std::optional<std::uint64_t> {
+			std::error_code ec;
+			// Stat before reading, so that a file changed while it is read is read again next time.
+			auto const size = std::filesystem::file_size(path, ec);
+			if (ec) { return std::nullopt; }
+			auto const time = std::filesystem::last_write_time(path, ec);
+			if (ec) { return std::nullopt; }
+			auto const time_count = static_cast<std::int64_t>(time.time_since_epoch().count());
+
+			auto const it = _entries.find(path);
+			if (it != _entries.end() && it->second.size == size && it->second.time == time_count) {
+				return it->second.hash;
+			}
+			std::ifstream fin{path, std::ios::binary};
+			if (!fin.is_open()) { return std::nullopt; }
+			fnv1a hash;
+			std::vector<char> buffer(std::size_t{1} << 16);
+			while (fin.read(buffer.data(), static_cast<std::streamsize>(buffer.size())) || fin.gcount() > 0) {
+				hash.add(buffer.data(), static_cast<std::size_t>(fin.gcount()));
+			}
+			if (fin.bad()) { return std::nullopt; }
+			_entries.insert_or_assign(path, entry{size, time_count, hash.get()});
+			return hash.get();
+		}
+
+		//! Serializes the cache as {path: {"size", "time", "hash"}}.
+		auto to_json() const -> nlohmann::json {
+			nlohmann::json result = nlohmann::json::object();
+			for (auto const& [path, e] : _entries) {
+				result[path] = {{"size", e.size}, {"time", e.time}, {"hash", fmt::format("{:016x}", e.hash)}};
+			}
+			return result;
+		}
+
+		//! Adds the entries of a cache serialized by to_json.
+		//! @throw nlohmann::json::exception if @p j is malformed.
+		auto load(nlohmann::json const& j) -> void {
+			for (auto const& [path, j_entry] : j.items()) {
+				_entries.insert_or_assign(path,
+					entry{j_entry.at("size").get<std::uintmax_t>(),
+						j_entry.at("time").get<std::int64_t>(),
+						std::stoull(j_entry.at("hash").get<std::string>(), nullptr, 16)});
+			}
+		}
+
+	private:
+		struct entry {
+			std::uintmax_t size;
+			std::int64_t time;
+			std::uint64_t hash;
+		};
+
+		std::unordered_map<std::string, entry> _entries;
+	};
+
+	//! Hashes everything that determines how @p c renders at @p scales with @p backend: its canonical JSON, which
+	//! includes its size, the scales, the backend, whether text is batched, and the path and contents of each font and
+	//! image it references, hashed through @p assets. Every scale is hashed, since smaller variants are downsampled
+	//! from the largest.
+	//! @note Settings that @p c leaves to process-wide defaults are not hashed, so resolve them first with
+	//! card::resolve_defaults.
+	inline auto build_hash(card const& c,
+		asset_hash_cache& assets,
+		std::vector<float> const& scales = {},
+		render_backend const& backend = get_gl_backend()) -> std::string {
+		fnv1a hash;
+		hash.add(c.to_json().dump());
+		hash.add(backend.get_name());
+		hash.add(std::uint64_t{sfe::rich_text::is_default_batched()});
+		for (auto const scale : scales) {
+			hash.add(&scale, sizeof(scale));
+		}
+		auto const add_file = [&](std::string const& path) {
+			hash.add(path);
+			// A missing file gets a hash of its own, so the card is rebuilt once the file appears.
+			hash.add(assets.get(path).value_or(0xffffffffffffffff));
+		};
+		for (auto const& path : c.referenced_fonts()) {
+			add_file(path);
+		}
+		for (auto const& path : c.referenced_images()) {
+			add_file(path);
+		}
+		return fmt::format("{:016x}", hash.get());
+	}
+
+	//! A sidecar file recording the build hash of each output from the previous run.
+	struct build_manifest {
+		//! Loads the manifest at @p path, or starts an empty one if there is no file at @p path.
+		//! @throw std::runtime_error if the file exists but is not a valid manifest.
+		build_manifest(std::string path) : _path{std::move(path)} {
+			std::ifstream fin{_path};
+			if (!fin.is_open()) { return; }
+			try {
+				// Keep the parsed document alive while iterating; items() only refers to it.
+				auto const j = nlohmann::json::parse(fin);
+				for (auto const& [output_path, hash] : j.at("outputs").items()) {
+					_hashes.emplace(output_path, hash.get<std::string>());
+				}
+				if (j.contains("assets")) { _assets.load(j["assets"]); }
+			} catch (nlohmann::json::exception const& ex) {
+				throw std::runtime_error{fmt::format("Invalid build manifest \"{}\": {}", _path, ex.what())};
+			}
+		}
+
+		//! Whether @p output_path was last built with @p hash and still exists.
+		auto is_up_to_date(std::string const& output_path, std::string const& hash) const -> bool {
+			auto const it = _hashes.find(output_path);
+			return it != _hashes.end() && it->second == hash && std::filesystem::exists(output_path);
+		}
+
+		//! Records that @p output_path was built with @p hash.
+		auto set(std::string const& output_path, std::string hash) -> void {
+			_hashes[output_path] = std::move(hash);
+		}
+
+		//! Forgets @p output_path, so that it is rebuilt next time.
+		auto erase(std::string const& output_path) -> void {
+			_hashes.erase(output_path);
+		}
+
+		//! The content hashes of assets, kept with the manifest so that unchanged assets are not read on every run.
+		auto get_assets() -> asset_hash_cache& {
+			return _assets;
+		}
+
+		//! Adds the records of @p other, e.g. another shard's manifest, replacing any for the same outputs. Asset
+		//! hashes are not merged, since they are keyed by modification times local to the node that computed them.
+		auto merge(build_manifest const& other) -> void {
+			for (auto const& [output_path, hash] : other._hashes) {
+				_hashes[output_path] = hash;
+			}
+		}
+
+		//! @return Whether the manifest was saved successfully.
+		auto save() const -> bool {
+			nlohmann::json outputs = nlohmann::json::object();
+			for (auto const& [output_path, hash] : _hashes) {
+				outputs[output_path] = hash;
+			}
+			std::ofstream fout{_path};
+			fout << nlohmann::json{{"outputs", outputs}, {"assets", _assets.to_json()}}.dump(1, '\t') << '\n';
+			return static_cast<bool>(fout);
+		}
+
+	private:
+		std::string _path;
+		std::unordered_map<std::string, std::string> _hashes;
+		asset_hash_cache _assets;
+	};
+}
@@ -0,0 +1,45 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Splitting a deck across independent render nodes.
+
+#pragma once
+
+#include "detail/hash.hpp"
+
+#include <fmt/format.h>
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace cg {
+	//! One of several disjoint parts of a deck. Cards are assigned to shards by a stable hash of their IDs, so every
+	//! node given the same deck agrees on the assignment without coordinating, and each card is in exactly one shard.
+	struct shard {
+		unsigned index = 0;
+		unsigned count = 1;
+
+		//! Whether the card with ID @p id is in this shard.
+		auto contains(std::string_view id) const -> bool {
+			return fnv1a{}.add(id).get() % count == index;
+		}
+	};
+
+	//! Parses a shard of the form "<index>/<count>", with 0 <= index < count.
+	//! @throw std::domain_error if @p value is not a valid shard.
+	inline auto parse_shard(std::string const& value) -> shard {
+		auto const invalid = [&] {
+			return std::domain_error{
+				fmt::format("Invalid shard \"{}\"; expected <index>/<count> with index < count.", value)};
+		};
+		auto const slash_pos = value.find('/');
+		if (slash_pos == std::string::npos) { throw invalid(); }
+		shard result;
+		try {
+			result.index = static_cast<unsigned>(std::stoul(value.substr(0, slash_pos)));
+			result.count = static_cast<unsigned>(std::stoul(value.substr(slash_pos + 1)));
+		} catch (std::logic_error const&) { throw invalid(); }
+		if (result.index >= result.count) { throw invalid(); }
+		return result;
+	}
+}
@@ -1,29 +1,781 @@
 //! @file
 //! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
 
-#include <card-gen/card-gen.hpp>
+#include <card-gen/atlas.hpp>
+#include <card-gen/backend.hpp>
+#include <card-gen/batch.hpp>
+#include <card-gen/card_template.hpp>
+#include <card-gen/deck_file.hpp>
+#include <card-gen/dedup.hpp>
+#include <card-gen/incremental.hpp>
+#include <card-gen/shard.hpp>
+
+#include "render_server.hpp"
 
 #include <fmt/format.h>
 #include <nlohmann/json.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
 #include <fstream>
+#include <functional>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
-auto main(int argc, char* argv[]) -> int {
-	if (argc != 3) {
-		fmt::print("Usage: card-gen input-filename output-filename\n");
-		return 0;
+namespace {
+	//! Where status and error messages are printed: standard output, unless frames are streamed there.
+	std::FILE* messages = stdout;
+
+	constexpr auto usage =
+		"Usage: card-gen [options] input-filename output-filename\n"
+		"       card-gen [options] --serve port\n"
+		"       card-gen --merge-manifests output-manifest input-manifest...\n"
+		"The input may be a card, a JSON array of cards, a templated deck, an NDJSON file with one card per line, a\n"
+		"binary deck (.cgdeck), or a directory of card files. Cards are parsed and rendered one at a time. When\n"
+		"rendering several cards, \"{}\" in output-filename is replaced with each card's ID.\n"
+		"Options:\n"
+		"  --jobs n            Render with n threads (0 for one per core). Default 1.\n"
+		"  --encoders n        Encode and write images with n threads (0 for one per core). Default 1.\n"
+		"  --batch-text        Draw each text element in a few draw calls per font instead of one or two per\n"
+		"                      chunk.\n"
+		"  --preload-fonts     Read the input twice: first to load every referenced font, then to render.\n"
+		"  --prewarm-glyphs    Read the input twice: first to rasterize every glyph the cards use in every size and\n"
+		"                      style they use it in, then to render.\n"
+		"  --atlas CxR         Render cards into grids of C columns and R rows on shared sheets, on one thread.\n"
+		"                      \"{}\" in output-filename is replaced with each sheet's index. A manifest of where\n"
+		"                      each card was placed is written to output-filename with \"{}\" replaced by\n"
+		"                      \"manifest\" and extension \".json\".\n"
+		"  --compile-deck      Write the input's cards to output-filename as a binary deck instead of rendering.\n"
+		"  --incremental path  Skip cards whose specification, fonts, images and output are unchanged since the\n"
+		"                      last run, as recorded in the build manifest at path.\n"
+		"  --shard i/N         Render only the cards in shard i of N, assigned by a hash of each card's ID, so that\n"
+		"                      N nodes given the same input render disjoint parts of the deck. In atlas mode, the\n"
+		"                      sheets and manifest have \"i-\" inserted before their index or \"manifest\".\n"
+		"  --merge-manifests   Combine the build or atlas manifests of several shards into output-manifest. Build\n"
+		"                      manifests are merged into any existing one; atlas manifests replace it.\n"
+		"  --dedup             Render identical cards, ignoring their IDs, once, and hard-link or copy their other\n"
+		"                      outputs to the first card's.\n"
+		"  --resample filter   Resize images to their on-card size once with the \"box\" or \"lanczos\" filter,\n"
+		"                      unless they specify a filter. Default \"none\", scaling when drawing.\n"
+		"  --scales s,...      Render each card at each comma-separated scale, e.g. \"1,0.5,0.25\", laying it out\n"
+		"                      once at the largest. \"@<scale>x\" is inserted before each output's extension.\n"
+		"  --format name       Encode cards without an output format of their own as \"png\" or \"qoi\" (faster,\n"
+		"                      larger), replacing the extension of output-filename.\n"
+		"  --compression n     Compress PNGs at level n, from 0 (uncompressed, fastest) to 9 (smallest), unless a\n"
+		"                      card specifies its level. Default 6.\n"
+		"  --frames path       Write each rendered card to path as a raw RGBA frame named by its output filename\n"
+		"                      instead of encoding and saving it. path may be a named pipe, or \"-\" for standard\n"
+		"                      output, in which case messages are printed to standard error.\n"
+		"  --backend name      Render with the \"gl\" (OpenGL, the default) or \"software\" (CPU only, for hosts\n"
+		"                      without a GPU) backend.\n"
+		"  --watch             Keep running, re-rendering the affected cards whenever the input or a referenced\n"
+		"                      font or image changes.\n"
+		"  --serve port        Instead of rendering files, serve renders over HTTP on 127.0.0.1:port until\n"
+		"                      interrupted: POST a card's JSON to /render to get its image. Caches and render\n"
+		"                      contexts stay warm between requests, which are handled by the --jobs threads.\n"
+		"  --asset-root path   In server mode, refuse cards whose fonts or images are outside path. Defaults to\n"
+		"                      the working directory.\n"
+		"  --profile path      Write the time spent in each rendering stage and counts such as cache hits and\n"
+		"                      draw calls to path as JSON.\n"
+		"  --profile-trace path\n"
+		"                      Write each timed stage of each card to path in the Chrome trace event format.\n";
+
+	//! Command-line arguments: positional arguments, "--name" flags and "--name value" options.
+	struct arguments {
+		std::vector<std::string> positional;
+		unsigned jobs = 1;
+		unsigned encoders = 1;
+		bool batch_text = false;
+		bool preload_fonts = false;
+		bool prewarm_glyphs = false;
+		bool compile_deck = false;
+		bool watch = false;
+		bool dedup = false;
+		bool merge_manifests = false;
+		//! The part of the deck to render.
+		cg::shard shard;
+		//! Port to serve renders on in server mode.
+		std::optional<std::uint16_t> serve;
+		//! The directory that the assets of served cards must be in.
+		std::string asset_root = ".";
+		//! Columns and rows per sheet in atlas mode.
+		std::optional<sf::Vector2u> atlas;
+		//! Path to the build manifest in incremental mode.
+		std::optional<std::string> incremental;
+		cg::render_backend const* backend = &cg::get_gl_backend();
+		//! Scales to render each card at, or empty to render each card once at its own size.
+		std::vector<float> scales;
+		//! Output format for cards that do not specify one, or empty to use the extension of the output filename.
+		std::optional<cg::image_format> format;
+		//! Path to stream raw frames to instead of saving images, or "-" for standard output.
+		std::optional<std::string> frames;
+		//! Paths to write the profile summary and trace to, if profiling.
+		std::optional<std::string> profile;
+		std::optional<std::string> profile_trace;
+	};
+
+	//! Parses a grid size of the form "<columns>x<rows>".
+	auto parse_grid(std::string const& value) -> sf::Vector2u {
+		auto const x_pos = value.find('x');
+		if (x_pos == std::string::npos) {
+			throw std::domain_error{fmt::format("Invalid grid size \"{}\"; expected <columns>x<rows>.", value)};
+		}
+		return {static_cast<unsigned>(std::stoul(value.substr(0, x_pos))),
+			static_cast<unsigned>(std::stoul(value.substr(x_pos + 1)))};
 	}
 
-	std::ifstream fin{argv[1]};
-	if (!fin.is_open()) {
-		fmt::print("Could not open card specification file \"{}\".", argv[1]);
-		return 0;
+	//! Parses a comma-separated list of distinct, finite, positive scale factors.
+	auto parse_scales(std::string const& value) -> std::vector<float> {
+		std::vector<float> result;
+		for (std::size_t begin = 0; begin <= value.size();) {
+			auto const end = std::min(value.find(',', begin), value.size());
+			auto const scale = std::stof(value.substr(begin, end - begin));
+			if (!std::isfinite(scale) || !(scale > 0)) {
+				throw std::domain_error{fmt::format("Invalid scale in \"{}\"; expected a finite number > 0.", value)};
+			}
+			// Equal scales would render the same variant to the same path twice.
+			if (std::find(result.begin(), result.end(), scale) != result.end()) {
+				throw std::domain_error{fmt::format("Duplicate scale {} in \"{}\".", scale, value)};
+			}
+			result.push_back(scale);
+			begin = end + 1;
+		}
+		return result;
 	}
 
-	try {
+	//! Parses a thread count, where zero means one thread per core.
+	auto parse_thread_count(std::string const& value) -> unsigned {
+		auto const result = static_cast<unsigned>(std::stoul(value));
+		return result == 0 ? std::max(1u, std::thread::hardware_concurrency()) : result;
+	}
+
+	auto parse_arguments(int argc, char* argv[]) -> arguments {
+		arguments result;
+		for (int i = 1; i < argc; ++i) {
+			std::string const arg = argv[i];
+			if (arg.rfind("--", 0) != 0) {
+				result.positional.push_back(arg);
+				continue;
+			}
+			if (arg == "--batch-text") {
+				result.batch_text = true;
+				continue;
+			}
+			if (arg == "--preload-fonts") {
+				result.preload_fonts = true;
+				continue;
+			}
+			if (arg == "--prewarm-glyphs") {
+				result.prewarm_glyphs = true;
+				continue;
+			}
+			if (arg == "--compile-deck") {
+				result.compile_deck = true;
+				continue;
+			}
+			if (arg == "--watch") {
+				result.watch = true;
+				continue;
+			}
+			if (arg == "--dedup") {
+				result.dedup = true;
+				continue;
+			}
+			if (arg == "--merge-manifests") {
+				result.merge_manifests = true;
+				continue;
+			}
+			if (i + 1 == argc) { throw std::domain_error{fmt::format("Missing value for option \"{}\".", arg)}; }
+			std::string const value = argv[++i];
+			if (arg == "--jobs") {
+				result.jobs = parse_thread_count(value);
+			} else if (arg == "--encoders") {
+				result.encoders = parse_thread_count(value);
+			} else if (arg == "--atlas") {
+				result.atlas = parse_grid(value);
+			} else if (arg == "--incremental") {
+				result.incremental = value;
+			} else if (arg == "--shard") {
+				result.shard = cg::parse_shard(value);
+			} else if (arg == "--resample") {
+				cg::set_default_resample_filter(cg::parse_resample_filter(value));
+			} else if (arg == "--format") {
+				result.format = cg::parse_image_format(value);
+			} else if (arg == "--compression") {
+				cg::set_default_compression_level(std::stoi(value));
+			} else if (arg == "--frames") {
+				result.frames = value;
+			} else if (arg == "--backend") {
+				result.backend = &cg::get_backend(value);
+			} else if (arg == "--scales") {
+				result.scales = parse_scales(value);
+			} else if (arg == "--serve") {
+				auto const port = std::stoul(value);
+				if (port == 0 || port > 65535) {
+					throw std::domain_error{fmt::format("Invalid port \"{}\"; expected 1 to 65535.", value)};
+				}
+				result.serve = static_cast<std::uint16_t>(port);
+			} else if (arg == "--asset-root") {
+				result.asset_root = value;
+			} else if (arg == "--profile") {
+				result.profile = value;
+			} else if (arg == "--profile-trace") {
+				result.profile_trace = value;
+			} else {
+				throw std::domain_error{fmt::format("Unknown option \"{}\".", arg)};
+			}
+		}
+		return result;
+	}
+
+	auto read_json(std::filesystem::path const& path) -> nlohmann::json {
+		std::ifstream fin{path};
+		if (!fin.is_open()) {
+			throw std::runtime_error{fmt::format("Could not open card specification file \"{}\".", path.string())};
+		}
+		cg::scoped_timer const timer{"parse json"};
 		nlohmann::json j;
 		fin >> j;
-		cg::card const c{j};
-		if (!c.render(argv[2])) { fmt::print("Failed to save card image to \"{}\".", argv[2]); }
-	} catch (std::exception& ex) { fmt::print("Error: {}", ex.what()); }
+		return j;
+	}
+
+	//! Gets the rows for a templated deck: either a JSON array of rows or the path to a CSV or JSON file of rows.
+	auto load_rows(nlohmann::json const& j_rows) -> std::vector<cg::template_row> {
+		if (!j_rows.is_string()) { return cg::rows_from_json(j_rows); }
+		std::filesystem::path const rows_path = j_rows.get<std::string>();
+		if (rows_path.extension() != ".csv") { return cg::rows_from_json(read_json(rows_path)); }
+		std::ifstream fin{rows_path};
+		if (!fin.is_open()) {
+			throw std::runtime_error{fmt::format("Could not open template rows file \"{}\".", rows_path.string())};
+		}
+		return cg::rows_from_csv(fin);
+	}
+
+	//! Calls @p submit with each card specified at @p input_path and its ID, building each card only as it is needed
+	//! so that memory use stays bounded regardless of deck size. The input may be a single card, a JSON array of
+	//! cards, a templated deck, a newline-delimited JSON file (.ndjson or .jsonl) with one card per line, a binary
+	//! deck (.cgdeck), or a directory of card specification files. A card's ID is its "id" field or value if present,
+	//! else its index in the deck or the stem of its file name. Only cards in @p shard are submitted. If @p spec_files
+	//! is not null, the paths of the specification files and directories read are appended to it.
+	template <typename F>
+	auto for_each_card(std::filesystem::path const& input_path,
+		cg::shard const& shard,
+		F&& submit,
+		std::vector<std::filesystem::path>* spec_files = nullptr) -> void {
+		if (spec_files) { spec_files->push_back(input_path); }
+		auto const submit_card = [&](cg::card c, std::string const& default_id) {
+			auto const id = c.id.empty() ? default_id : c.id;
+			if (shard.contains(id)) { submit(std::move(c), id); }
+		};
+
+		if (std::filesystem::is_directory(input_path)) {
+			std::vector<std::filesystem::path> spec_paths;
+			for (auto const& entry : std::filesystem::directory_iterator{input_path}) {
+				if (entry.is_regular_file() && entry.path().extension() == ".json") {
+					spec_paths.push_back(entry.path());
+				}
+			}
+			// Sort for a deterministic render order.
+			std::sort(spec_paths.begin(), spec_paths.end());
+			for (auto const& spec_path : spec_paths) {
+				if (spec_files) { spec_files->push_back(spec_path); }
+				submit_card(cg::card{read_json(spec_path)}, spec_path.stem().string());
+			}
+			return;
+		}
+
+		auto const extension = input_path.extension();
+		if (extension == ".cgdeck") {
+			cg::deck_file const deck{input_path.string()};
+			for (std::size_t i = 0; i < deck.size(); ++i) {
+				submit_card(deck.get(i), std::to_string(i));
+			}
+			return;
+		}
+
+		std::ifstream fin{input_path};
+		if (!fin.is_open()) {
+			throw std::runtime_error{
+				fmt::format("Could not open card specification file \"{}\".", input_path.string())};
+		}
+
+		if (extension == ".ndjson" || extension == ".jsonl") {
+			std::size_t index = 0;
+			for (std::string line; std::getline(fin, line);) {
+				if (line.find_first_not_of(" \t\r") == std::string::npos) { continue; }
+				cg::scoped_timer parse_timer{"parse json"};
+				auto const j = nlohmann::json::parse(line);
+				parse_timer.stop();
+				submit_card(cg::card{j}, std::to_string(index++));
+			}
+			return;
+		}
+
+		// Submit the cards of a top-level array as each one is parsed, and discard them from the DOM.
+		bool is_array = false;
+		std::size_t index = 0;
+		using event_t = nlohmann::json::parse_event_t;
+		auto const j = nlohmann::json::parse(fin, [&](int depth, event_t event, nlohmann::json& parsed) {
+			if (depth == 0 && event == event_t::array_start) { is_array = true; }
+			if (is_array && depth == 1 && event == event_t::object_end) {
+				submit_card(cg::card{parsed}, std::to_string(index++));
+				return false;
+			}
+			return true;
+		});
+		if (is_array) { return; }
+
+		if (j.contains("template")) {
+			// Templated deck: {"template": card with placeholders, "rows": rows or path to rows}.
+			cg::card_template const t{j["template"]};
+			nlohmann::json const& j_rows = j.at("rows");
+			if (spec_files && j_rows.is_string()) { spec_files->push_back(j_rows.get<std::string>()); }
+			auto const rows = load_rows(j_rows);
+			for (std::size_t i = 0; i < rows.size(); ++i) {
+				submit_card(t.instantiate(rows[i]), std::to_string(i));
+			}
+		} else {
+			submit_card(cg::card{j}, "0");
+		}
+	}
+
+	//! Gives @p c the output format requested by @p args unless it specifies its own, resolves its other defaults so
+	//! that build hashes cover them, and gets its output path: @p output_pattern with "{}" replaced by @p id and, if
+	//! the card has an output format, the extension replaced by the format's.
+	auto prepare_output(cg::card& c, std::string const& output_pattern, std::string const& id, arguments const& args)
+		-> std::string {
+		if (!c.output.format) { c.output.format = args.format; }
+		c.resolve_defaults();
+		std::filesystem::path result = cg::expand_pattern(output_pattern, id);
+		if (c.output.format) { result.replace_extension(cg::get_extension(*c.output.format)); }
+		return result.string();
+	}
+
+	//! The output paths claimed by the cards of one run, so that a card whose outputs would replace another card's is
+	//! reported rather than silently overwriting it.
+	struct output_claims {
+		explicit output_claims(std::string const& output_pattern)
+			: _has_placeholder{output_pattern.find("{}") != std::string::npos} {}
+
+		//! Claims @p output_path, the output of the card @p id, returning an error if another card already claimed it.
+		//! Every card of a run has the same scales, so its scaled outputs collide exactly when its output path does.
+		//! @throw std::domain_error if this is not the first card and the output pattern has no "{}", since every card
+		//! would then be written to the same file.
+		auto claim(std::string const& output_path, std::string const& id) -> std::optional<std::string> {
+			if (!_has_placeholder && !_ids.empty()) {
+				throw std::domain_error{
+					"Several cards were given, so output-filename must contain \"{}\" to name each card's output."};
+			}
+			auto const [it, claimed] = _ids.emplace(output_path, id);
+			if (claimed) { return std::nullopt; }
+			return fmt::format("Skipped card \"{}\" because its output \"{}\" is already written by card \"{}\".",
+				id,
+				output_path,
+				it->second);
+		}
+
+	private:
+		bool _has_placeholder;
+		//! The ID of the card that claimed each output path.
+		std::unordered_map<std::string, std::string> _ids;
+	};
+
+	//! Gets what each render thread does when it starts: with --prewarm-glyphs, rasterize the collected glyphs into its
+	//! own fonts before its first card.
+	auto get_thread_start(arguments const& args) -> std::function<void()> {
+		if (!args.prewarm_glyphs) { return {}; }
+		return [] { cg::font_cache::instance().prewarm_thread(); };
+	}
+
+	//! Gets the modification time of @p path, or the minimum time if it does not exist.
+	auto get_write_time(std::filesystem::path const& path) -> std::filesystem::file_time_type {
+		std::error_code ec;
+		auto const result = std::filesystem::last_write_time(path, ec);
+		return ec ? std::filesystem::file_time_type::min() : result;
+	}
+
+	//! Renders the cards at @p input_path, then re-renders the affected cards whenever the specification or an asset
+	//! changes, until the process is interrupted. The render threads, their contexts and the font and texture caches
+	//! stay alive between renders.
+	auto watch(std::filesystem::path const& input_path, std::string const& output_pattern, arguments const& args)
+		-> void {
+		std::optional<cg::frame_sink> frames;
+		if (args.frames) { frames.emplace(*args.frames); }
+		cg::stream_renderer renderer{
+			args.jobs, args.encoders, *args.backend, frames ? &*frames : nullptr, get_thread_start(args)};
+		// The build hash each output was last rendered with.
+		std::unordered_map<std::string, std::string> hashes;
+		cg::asset_hash_cache assets;
+		// The modification time of each watched file, as of the last render.
+		std::map<std::filesystem::path, std::filesystem::file_time_type> spec_times;
+		std::map<std::string, std::filesystem::file_time_type> asset_times;
+
+		auto const render = [&] {
+			auto const start = std::chrono::steady_clock::now();
+			std::vector<std::filesystem::path> spec_files;
+			std::map<std::string, std::filesystem::file_time_type> new_asset_times;
+			std::vector<std::string> rendered;
+			output_claims claims{output_pattern};
+			try {
+				for_each_card(
+					input_path,
+					args.shard,
+					[&](cg::card c, std::string const& id) {
+						for (auto const& paths : {c.referenced_fonts(), c.referenced_images()}) {
+							for (auto const& path : paths) {
+								new_asset_times.emplace(path, get_write_time(path));
+							}
+						}
+						auto output_path = prepare_output(c, output_pattern, id, args);
+						if (auto error = claims.claim(output_path, id)) {
+							fmt::print(messages, "Error: {}\n", *error);
+							return;
+						}
+						auto hash = cg::build_hash(c, assets, args.scales, *args.backend);
+						auto& old_hash = hashes[output_path];
+						if (old_hash == hash) { return; }
+						old_hash = std::move(hash);
+						rendered.push_back(output_path);
+						renderer.submit({std::move(c), std::move(output_path), args.scales});
+					},
+					&spec_files);
+			} catch (std::exception const& ex) {
+				// Likely a specification saved mid-edit. Keep watching, and try again on the next change.
+				fmt::print(messages, "Error: {}\n", ex.what());
+			}
+			// Forget the hashes of cards that failed, so that they are rendered again on the next pass.
+			for (auto const& error : renderer.wait()) {
+				fmt::print(messages, "Error: {}\n", error.message);
+				hashes.erase(error.output_path);
+			}
+
+			spec_times.clear();
+			for (auto const& path : spec_files) {
+				spec_times.emplace(path, get_write_time(path));
+			}
+			asset_times.insert(new_asset_times.begin(), new_asset_times.end());
+			auto const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - start);
+			fmt::print(messages,
+				"Rendered {} cards in {} ms. Watching for changes...\n",
+				rendered.size(),
+				elapsed.count());
+		};
+
+		render();
+		for (;;) {
+			std::this_thread::sleep_for(std::chrono::milliseconds{100});
+			bool changed = false;
+			for (auto const& [path, time] : spec_times) {
+				if (get_write_time(path) != time) { changed = true; }
+			}
+			for (auto& [path, time] : asset_times) {
+				auto const new_time = get_write_time(path);
+				if (new_time == time) { continue; }
+				// Reload the asset, and redraw base layers, which may include it.
+				time = new_time;
+				cg::font_cache::instance().erase(path);
+				cg::texture_cache::instance().erase(path);
+				cg::software_renderer::erase_image(path);
+				cg::base_layer_cache().clear();
+				changed = true;
+			}
+			if (changed) { render(); }
+		}
+	}
+
+	//! Combines the build or atlas manifests at @p input_paths, e.g. from the shards of a deck, into a manifest at
+	//! @p output_path. Build manifests are merged into any existing build manifest there; an atlas manifest replaces
+	//! any existing file.
+	//! @throw std::runtime_error if an input is not a manifest, or the inputs are not all of the same kind.
+	auto merge_manifests(std::string const& output_path, std::vector<std::string> const& input_paths) -> void {
+		std::vector<nlohmann::json> manifests;
+		for (auto const& path : input_paths) {
+			std::ifstream fin{path};
+			if (!fin.is_open()) { throw std::runtime_error{fmt::format("Could not open manifest \"{}\".", path)}; }
+			manifests.push_back(nlohmann::json::parse(fin));
+		}
+
+		auto const is_atlas = [&](std::size_t i) {
+			auto const& manifest = manifests[i];
+			if (manifest.is_object() && manifest.contains("sheets")) { return true; }
+			if (manifest.is_object() && manifest.contains("outputs")) { return false; }
+			throw std::runtime_error{
+				fmt::format("\"{}\" is neither a build manifest nor an atlas manifest.", input_paths[i])};
+		};
+		auto const get_kind = [](bool atlas) { return atlas ? "an atlas" : "a build"; };
+		auto const atlas = is_atlas(0);
+		for (std::size_t i = 1; i < manifests.size(); ++i) {
+			if (is_atlas(i) != atlas) {
+				throw std::runtime_error{fmt::format("Cannot merge {} manifest \"{}\" with {} manifest \"{}\".",
+					get_kind(atlas),
+					input_paths.front(),
+					get_kind(!atlas),
+					input_paths[i])};
+			}
+		}
+
+		if (atlas) {
+			auto const merged = cg::merge_atlas_manifests(manifests);
+			std::ofstream fout{output_path};
+			fout << merged.dump(1, '\t') << '\n';
+			if (!fout) { throw std::runtime_error{fmt::format("Failed to save manifest to \"{}\".", output_path)}; }
+			fmt::print(messages,
+				"Merged {} atlas manifests with {} sheets and {} cards.\n",
+				manifests.size(),
+				merged["sheets"].size(),
+				merged["cards"].size());
+			return;
+		}
+
+		cg::build_manifest merged{output_path};
+		for (auto const& path : input_paths) {
+			merged.merge(cg::build_manifest{path});
+		}
+		if (!merged.save()) {
+			throw std::runtime_error{fmt::format("Failed to save manifest to \"{}\".", output_path)};
+		}
+		fmt::print(messages, "Merged {} build manifests.\n", manifests.size());
+	}
+
+	//! Saves the profile summary and trace requested by @p args, if any.
+	auto save_profile(arguments const& args) -> void {
+		auto const& profiler = cg::profiler::instance();
+		if (args.profile && !profiler.save_summary(*args.profile)) {
+			fmt::print(messages, "Failed to save profile to \"{}\".\n", *args.profile);
+		}
+		if (args.profile_trace && !profiler.save_trace(*args.profile_trace)) {
+			fmt::print(messages, "Failed to save profile trace to \"{}\".\n", *args.profile_trace);
+		}
+	}
+}
+
+auto main(int argc, char* argv[]) -> int {
+	try {
+		auto const args = parse_arguments(argc, argv);
+		if (args.serve) {
+			if (!args.positional.empty()) { throw std::domain_error{"Server mode takes no input or output filename."}; }
+			if (args.profile || args.profile_trace) { throw std::domain_error{"Profiling does not support serving."}; }
+			sfe::rich_text::set_default_batched(args.batch_text);
+			fmt::print(
+				messages, "Serving renders at http://127.0.0.1:{}/render on {} threads.\n", *args.serve, args.jobs);
+			std::fflush(messages);
+			cg::server_options options;
+			options.port = *args.serve;
+			options.thread_count = args.jobs;
+			options.backend = args.backend;
+			options.asset_root = args.asset_root;
+			cg::serve(options);
+			return 0;
+		}
+		if (args.merge_manifests) {
+			if (args.positional.size() < 2) {
+				throw std::domain_error{"Merging manifests takes an output manifest and at least one input manifest."};
+			}
+			merge_manifests(args.positional[0], {args.positional.begin() + 1, args.positional.end()});
+			return 0;
+		}
+		if (args.positional.size() != 2) {
+			fmt::print("{}", usage);
+			return 0;
+		}
+
+		if (args.frames == "-") { messages = stderr; }
+		sfe::rich_text::set_default_batched(args.batch_text);
+		if (args.profile || args.profile_trace) {
+			if (args.watch) { throw std::domain_error{"Profiling does not support watching."}; }
+			cg::profiler::instance().enable(args.profile_trace.has_value());
+		}
+
+		auto const& input_path = args.positional[0];
+		auto const& output_pattern = args.positional[1];
+
+		if (args.compile_deck) {
+			// Store each card's resolved ID so that rendering the binary deck names outputs the same way.
+			cg::deck_writer writer{output_pattern};
+			for_each_card(input_path, args.shard, [&](cg::card c, std::string const& id) {
+				c.id = id;
+				writer.add(c);
+			});
+			writer.finish();
+			save_profile(args);
+			return 0;
+		}
+
+		if (args.preload_fonts) {
+			for_each_card(input_path, args.shard, [](cg::card const& c, std::string const&) { //
+				cg::font_cache::instance().preload(c.referenced_fonts());
+			});
+		}
+
+		if (args.prewarm_glyphs) {
+			std::map<std::string, cg::glyph_set> glyphs;
+			// Glyphs are rasterized at their rendered size, so collect them from each card as laid out for rendering:
+			// at its largest scale, which render_images downsamples to the others.
+			auto const largest_scale =
+				args.scales.empty() ? 1.0f : *std::max_element(args.scales.begin(), args.scales.end());
+			for_each_card(input_path, args.shard, [&](cg::card const& c, std::string const&) {
+				if (largest_scale == 1) {
+					c.add_referenced_glyphs(glyphs);
+				} else {
+					c.scaled(largest_scale).add_referenced_glyphs(glyphs);
+				}
+			});
+			for (auto& [path, set] : glyphs) {
+				cg::font_cache::instance().prewarm(path, std::move(set));
+			}
+		}
+
+		if (args.atlas && (args.incremental || args.watch)) {
+			throw std::domain_error{"Atlas mode does not support incremental rebuilds or watching."};
+		}
+		if (args.atlas && !args.scales.empty()) {
+			throw std::domain_error{"Atlas mode does not support rendering at several scales."};
+		}
+		if (args.frames && (args.atlas || args.incremental)) {
+			throw std::domain_error{"Streaming frames does not support atlas mode or incremental rebuilds."};
+		}
+		if (args.dedup && (args.atlas || args.frames || args.watch)) {
+			throw std::domain_error{"Deduplication does not support atlas mode, streaming frames or watching."};
+		}
+		if (args.atlas && args.format) {
+			throw std::domain_error{"Atlas mode takes its output format from the output filename's extension."};
+		}
+		if (args.atlas && args.backend != &cg::get_gl_backend()) {
+			throw std::domain_error{"Atlas mode only supports the gl backend."};
+		}
+
+		if (args.watch) {
+			// Watched files may be saved in place while loaded, which a mapping of them would not survive.
+			cg::mapped_file::set_default_mode(cg::mapped_file::mode::copy);
+			watch(input_path, output_pattern, args);
+			return 0;
+		}
+
+		// All cards share one process, so the GL contexts and the font and image caches are reused across the deck.
+		if (args.atlas) {
+			cg::image_writer writer{args.encoders};
+			// Shards share the output pattern, so give each shard's sheets and manifest distinct names.
+			auto const sheet_pattern = args.shard.count == 1
+				? output_pattern
+				: cg::expand_pattern(output_pattern, fmt::format("{}-{{}}", args.shard.index));
+			cg::atlas_writer atlas{sheet_pattern, *args.atlas, writer};
+			for_each_card(input_path, args.shard, [&](cg::card c, std::string const& id) { atlas.add(c, id); });
+			for (auto const& error : atlas.finish()) {
+				fmt::print(messages, "Error: {}\n", error);
+			}
+			auto const manifest_path =
+				std::filesystem::path{cg::expand_pattern(sheet_pattern, "manifest")}.replace_extension(".json");
+			if (!atlas.save_manifest(manifest_path.string())) {
+				fmt::print(messages, "Failed to save atlas manifest to \"{}\".\n", manifest_path.string());
+			}
+		} else {
+			std::optional<cg::build_manifest> manifest;
+			if (args.incremental) { manifest.emplace(*args.incremental); }
+			// Outputs being rebuilt and their new build hashes.
+			std::vector<std::pair<std::string, std::string>> rebuilt;
+			std::size_t rebuilt_cards = 0;
+			std::size_t skipped = 0;
+			std::optional<cg::duplicate_tracker> duplicates;
+			if (args.dedup) { duplicates.emplace(); }
+			// Outputs to link to identical outputs once those are rendered, as (original, duplicate) pairs.
+			std::vector<std::pair<std::string, std::string>> links;
+
+			std::optional<cg::frame_sink> frames;
+			if (args.frames) { frames.emplace(*args.frames); }
+			cg::stream_renderer renderer{
+				args.jobs, args.encoders, *args.backend, frames ? &*frames : nullptr, get_thread_start(args)};
+			output_claims claims{output_pattern};
+			// Cards skipped because their outputs were already written in this run.
+			std::vector<std::string> collisions;
+			for_each_card(input_path, args.shard, [&](cg::card c, std::string const& id) {
+				auto output_path = prepare_output(c, output_pattern, id, args);
+				if (auto error = claims.claim(output_path, id)) {
+					collisions.push_back(std::move(*error));
+					return;
+				}
+				cg::render_job job{std::move(c), std::move(output_path), args.scales};
+				auto const output_paths = job.get_output_paths();
+				auto const original =
+					duplicates ? duplicates->find_or_add(job.card, job.scales, output_paths) : nullptr;
+				if (manifest) {
+					auto const hash = cg::build_hash(job.card, manifest->get_assets(), job.scales, *args.backend);
+					auto const is_up_to_date = [&](std::string const& path) {
+						return manifest->is_up_to_date(path, hash);
+					};
+					if (std::all_of(output_paths.begin(), output_paths.end(), is_up_to_date)) {
+						++skipped;
+						return;
+					}
+					++rebuilt_cards;
+					for (auto const& output_path : output_paths) {
+						rebuilt.emplace_back(output_path, hash);
+					}
+				}
+				if (original) {
+					for (std::size_t i = 0; i < output_paths.size(); ++i) {
+						links.emplace_back((*original)[i], output_paths[i]);
+					}
+					return;
+				}
+				renderer.submit(std::move(job));
+			});
+			auto errors = renderer.finish();
+			// The outputs that were not written.
+			std::unordered_set<std::string> failed_paths;
+			for (auto const& error : errors) {
+				failed_paths.insert(error.failed_paths.begin(), error.failed_paths.end());
+			}
+			std::size_t linked = 0;
+			std::vector<std::string> skipped_links;
+			for (auto const& [from, to] : links) {
+				if (failed_paths.count(from) != 0) {
+					skipped_links.push_back(to);
+				} else if (cg::link_or_copy(from, to)) {
+					++linked;
+				} else {
+					errors.push_back({to, {to}, fmt::format("Could not link or copy \"{}\" to \"{}\".", from, to)});
+					failed_paths.insert(to);
+				}
+			}
+			if (!skipped_links.empty()) {
+				auto message = fmt::format(
+					"Skipped {} duplicate outputs because their originals failed.", skipped_links.size());
+				failed_paths.insert(skipped_links.begin(), skipped_links.end());
+				errors.push_back({{}, std::move(skipped_links), std::move(message)});
+			}
+			for (auto& collision : collisions) {
+				// The colliding card's outputs belong to the card that claimed them first, so none are failed.
+				errors.push_back({{}, {}, std::move(collision)});
+			}
+			for (auto const& error : errors) {
+				fmt::print(messages, "Error: {}\n", error.message);
+			}
+			if (duplicates) { fmt::print(messages, "Linked {} outputs of duplicate cards.\n", linked); }
+
+			if (manifest) {
+				for (auto& [output_path, hash] : rebuilt) {
+					if (failed_paths.count(output_path) == 0) {
+						manifest->set(output_path, std::move(hash));
+					} else {
+						manifest->erase(output_path);
+					}
+				}
+				if (!manifest->save()) {
+					fmt::print(messages, "Failed to save build manifest to \"{}\".\n", *args.incremental);
+				}
+				fmt::print(messages, "Rendered {} cards; skipped {} unchanged cards.\n", rebuilt_cards, skipped);
+			}
+		}
+		save_profile(args);
+	} catch (std::exception& ex) { fmt::print(messages, "Error: {}\n", ex.what()); }
 }
@@ -0,0 +1,353 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+
+#include "render_server.hpp"
+
+#include <card-gen/detail/bounded_queue.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace cg {
+	namespace {
+#ifdef _WIN32
+		using socket_handle = SOCKET;
+		constexpr socket_handle invalid_socket = INVALID_SOCKET;
+
+		auto close_socket(socket_handle s) -> void {
+			closesocket(s);
+		}
+#else
+		using socket_handle = int;
+		constexpr socket_handle invalid_socket = -1;
+
+		auto close_socket(socket_handle s) -> void {
+			close(s);
+		}
+#endif
+
+		//! Requests whose headers are longer are refused.
+		constexpr std::size_t max_header_size = 16 << 10;
+		//! Connections that take longer than this to send a whole request, or to receive a whole response, are
+		//! dropped, so a slow or stalled client cannot hold a worker.
+		constexpr std::chrono::seconds transfer_timeout{10};
+		//! The longest side of a card the server renders, which is within common GPUs' texture size limits.
+		constexpr int max_card_side = 16384;
+
+		using deadline = std::chrono::steady_clock::time_point;
+
+		struct http_request {
+			std::string method;
+			std::string path;
+			std::string body;
+		};
+
+		struct http_response {
+			int status;
+			std::string content_type;
+			std::string body;
+		};
+
+		auto get_reason(int status) -> char const* {
+			switch (status) {
+				case 200: return "OK";
+				case 400: return "Bad Request";
+				case 403: return "Forbidden";
+				case 404: return "Not Found";
+				case 405: return "Method Not Allowed";
+				case 411: return "Length Required";
+				case 413: return "Payload Too Large";
+				case 431: return "Request Header Fields Too Large";
+				default: return "Internal Server Error";
+			}
+		}
+
+		auto error(int status, std::string message) -> http_response {
+			return {status, "text/plain; charset=utf-8", std::move(message) + "\n"};
+		}
+
+		//! Limits the next blocking receive or send on @p s, as @p option selects, to the time left until @p end.
+		//! Socket timeouts apply to each call rather than to a whole transfer, so they are set before every call.
+		//! @return Whether any time is left.
+		auto set_timeout(socket_handle s, int option, deadline end) -> bool {
+			auto const remaining =
+				std::chrono::duration_cast<std::chrono::milliseconds>(end - std::chrono::steady_clock::now()).count();
+			// A zero timeout would mean no timeout at all.
+			if (remaining <= 0) { return false; }
+#ifdef _WIN32
+			DWORD const timeout = static_cast<DWORD>(remaining);
+#else
+			timeval const timeout{static_cast<decltype(timeval::tv_sec)>(remaining / 1000),
+				static_cast<decltype(timeval::tv_usec)>(remaining % 1000 * 1000)};
+#endif
+			return setsockopt(s, SOL_SOCKET, option, reinterpret_cast<char const*>(&timeout), sizeof(timeout)) == 0;
+		}
+
+		//! Receives up to @p size bytes into @p out, returning the number received or nothing on error or once @p end
+		//! has passed.
+		auto receive(socket_handle s, char* out, std::size_t size, deadline end) -> std::optional<std::size_t> {
+			if (!set_timeout(s, SO_RCVTIMEO, end)) { return std::nullopt; }
+			auto const received = recv(s, out, static_cast<int>(std::min<std::size_t>(size, 1 << 20)), 0);
+			if (received < 0) { return std::nullopt; }
+			return static_cast<std::size_t>(received);
+		}
+
+		//! Sends @p size bytes from @p data, failing on error or once @p end has passed.
+		auto send_all(socket_handle s, char const* data, std::size_t size, deadline end) -> bool {
+#ifdef MSG_NOSIGNAL
+			// A client that hangs up early must not kill the server with SIGPIPE.
+			constexpr int flags = MSG_NOSIGNAL;
+#else
+			constexpr int flags = 0;
+#endif
+			while (size > 0) {
+				if (!set_timeout(s, SO_SNDTIMEO, end)) { return false; }
+				auto const sent = send(s, data, static_cast<int>(std::min<std::size_t>(size, 1 << 20)), flags);
+				if (sent <= 0) { return false; }
+				data += sent;
+				size -= static_cast<std::size_t>(sent);
+			}
+			return true;
+		}
+
+		//! Reads a request from @p s into @p request.
+		//! @return An error response if the request is malformed or too large, or nothing if it was read completely.
+		//! Also nothing, with an empty method, if the client closed the connection or did not send the whole request
+		//! within transfer_timeout.
+		auto read_request(socket_handle s, http_request& request, std::size_t max_body_size)
+			-> std::optional<http_response> {
+			auto const end = std::chrono::steady_clock::now() + transfer_timeout;
+			std::string data;
+			std::size_t header_end;
+			char buffer[4096];
+			for (;;) {
+				header_end = data.find("\r\n\r\n");
+				if (header_end != std::string::npos) { break; }
+				if (data.size() > max_header_size) { return error(431, "Request headers are too long."); }
+				auto const received = receive(s, buffer, sizeof(buffer), end);
+				if (!received || *received == 0) { return std::nullopt; }
+				data.append(buffer, *received);
+			}
+
+			// Request line: method, target and version.
+			auto const line_end = data.find("\r\n");
+			auto const method_end = data.find(' ');
+			auto const path_end = data.find(' ', method_end + 1);
+			if (method_end == std::string::npos || path_end == std::string::npos || path_end > line_end) {
+				return error(400, "Malformed request line.");
+			}
+			request.method = data.substr(0, method_end);
+			request.path = data.substr(method_end + 1, path_end - method_end - 1);
+			// Ignore any query string.
+			request.path = request.path.substr(0, request.path.find('?'));
+
+			// Only Content-Length matters; bodies must not be chunked.
+			std::optional<std::size_t> content_length;
+			for (auto begin = line_end + 2; begin < header_end;) {
+				auto const end = data.find("\r\n", begin);
+				auto const line = data.substr(begin, end - begin);
+				begin = end + 2;
+				auto const colon = line.find(':');
+				if (colon == std::string::npos) { continue; }
+				auto name = line.substr(0, colon);
+				std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) {
+					return static_cast<char>(std::tolower(c));
+				});
+				if (name != "content-length") { continue; }
+				try {
+					content_length = std::stoull(line.substr(colon + 1));
+				} catch (std::exception const&) { return error(400, "Invalid Content-Length."); }
+			}
+			if (request.method != "POST") { return std::nullopt; }
+			if (!content_length) { return error(411, "A Content-Length is required."); }
+			if (*content_length > max_body_size) {
+				return error(413, fmt::format("Request bodies are limited to {} bytes.", max_body_size));
+			}
+
+			request.body = data.substr(header_end + 4);
+			while (request.body.size() < *content_length) {
+				auto const remaining = *content_length - request.body.size();
+				auto const received = receive(s, buffer, std::min(sizeof(buffer), remaining), end);
+				if (!received || *received == 0) {
+					request.method.clear();
+					return std::nullopt;
+				}
+				request.body.append(buffer, *received);
+			}
+			request.body.resize(*content_length);
+			return std::nullopt;
+		}
+
+		//! Decides which asset paths requests may use: paths of existing files under the asset root, spelled in
+		//! normal form with forward slashes and without symbolic links. Each path a request uses is interned or cached
+		//! for the life of the process, so allowing at most two spellings, relative and absolute, of each file bounds
+		//! what clients can make the server keep.
+		struct asset_policy {
+			//! Canonical.
+			std::filesystem::path root;
+			//! Canonical. Relative asset paths are resolved against it, as the asset caches resolve them.
+			std::filesystem::path working_dir;
+
+			//! @return An error response if requests may not use @p path, or nothing if they may.
+			auto check(std::string const& path) const -> std::optional<http_response> {
+				std::filesystem::path const spelled{path};
+				std::error_code ec;
+				// Resolve "..", "." and symbolic links, so that none of them can lead out of the root.
+				auto const resolved = std::filesystem::weakly_canonical(working_dir / spelled, ec);
+				auto const is_under_root =
+					std::mismatch(root.begin(), root.end(), resolved.begin(), resolved.end()).first == root.end();
+				if (ec || !is_under_root) {
+					return error(403, fmt::format("Asset \"{}\" is outside the server's asset root.", path));
+				}
+				if (!std::filesystem::is_regular_file(resolved, ec)) {
+					return error(400, fmt::format("Asset \"{}\" does not exist.", path));
+				}
+				if (spelled.lexically_normal().generic_string() != path || working_dir / spelled != resolved) {
+					auto const canonical = resolved.generic_string();
+					return error(400, fmt::format("Asset path \"{}\" is not canonical; use \"{}\".", path, canonical));
+				}
+				return std::nullopt;
+			}
+		};
+
+		auto handle(http_request const& request, server_options const& options, asset_policy const& assets)
+			-> http_response {
+			if (request.path == "/health") {
+				if (request.method != "GET") { return error(405, "Use GET for /health."); }
+				return {200, "text/plain; charset=utf-8", "ok\n"};
+			}
+			if (request.path != "/render") { return error(404, fmt::format("Unknown path \"{}\".", request.path)); }
+			if (request.method != "POST") { return error(405, "Use POST for /render."); }
+
+			// Assets are checked before they are interned or loaded: image paths before the card is read from its
+			// JSON, and font paths before it renders.
+			std::optional<card> c;
+			try {
+				auto const j = nlohmann::json::parse(request.body);
+				for (auto const& j_element : j.at("elements")) {
+					auto const image_it = j_element.find("image");
+					if (image_it == j_element.end()) { continue; }
+					if (auto refusal = assets.check(image_it->at("path").get<std::string>())) { return *refusal; }
+				}
+				c.emplace(j);
+				for (auto const& path : c->referenced_fonts()) {
+					if (auto refusal = assets.check(path)) { return *refusal; }
+				}
+			} catch (std::exception const& ex) {
+				return error(400, fmt::format("Invalid card specification: {}", ex.what()));
+			}
+			// Render textures and software canvases are allocated at the card's size, so that a single request
+			// cannot exhaust the server's memory.
+			if (c->size.x <= 0 || c->size.y <= 0) {
+				return error(400, fmt::format("Invalid card size {}x{}.", c->size.x, c->size.y));
+			}
+			auto const pixels = std::size_t{static_cast<unsigned>(c->size.x)} * static_cast<unsigned>(c->size.y);
+			if (c->size.x > max_card_side || c->size.y > max_card_side || pixels > options.max_card_pixels) {
+				return error(413,
+					fmt::format("Card size {}x{} exceeds the limit of {} pixels and {} pixels per side.",
+						c->size.x,
+						c->size.y,
+						options.max_card_pixels,
+						max_card_side));
+			}
+			try {
+				auto const bytes = options.backend->render_encoded(*c);
+				auto const format = c->output.format.value_or(image_format::png);
+				return {200, "image/" + to_string(format), std::string(bytes.begin(), bytes.end())};
+			} catch (std::exception const& ex) {
+				return error(500, fmt::format("Could not render card: {}", ex.what()));
+			}
+		}
+
+		auto serve_connection(socket_handle s, server_options const& options, asset_policy const& assets) -> void {
+			http_request request;
+			auto response = read_request(s, request, options.max_body_size);
+			if (!response) {
+				// The client went away before sending a whole request.
+				if (request.method.empty()) { return; }
+				response = handle(request, options, assets);
+			}
+			auto const head = fmt::format(
+				"HTTP/1.1 {} {}\r\nContent-Type: {}\r\nContent-Length: {}\r\nConnection: close\r\n\r\n",
+				response->status,
+				get_reason(response->status),
+				response->content_type,
+				response->body.size());
+			auto const end = std::chrono::steady_clock::now() + transfer_timeout;
+			if (send_all(s, head.data(), head.size(), end)) {
+				send_all(s, response->body.data(), response->body.size(), end);
+			}
+		}
+	}
+
+	auto serve(server_options const& options) -> void {
+#ifdef _WIN32
+		WSADATA wsa_data;
+		if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) { throw std::runtime_error{"Could not initialize Winsock."}; }
+#endif
+		std::error_code ec;
+		asset_policy assets;
+		assets.root = std::filesystem::canonical(options.asset_root, ec);
+		if (ec) {
+			throw std::runtime_error{
+				fmt::format("Invalid asset root \"{}\": {}", options.asset_root.string(), ec.message())};
+		}
+		assets.working_dir = std::filesystem::canonical(std::filesystem::current_path());
+		auto const listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (listener == invalid_socket) { throw std::runtime_error{"Could not create the server socket."}; }
+		int const reuse = 1;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char const*>(&reuse), sizeof(reuse));
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(options.port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (bind(listener, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) != 0
+			|| listen(listener, SOMAXCONN) != 0) {
+			close_socket(listener);
+			throw std::runtime_error{fmt::format("Could not listen on port {}.", options.port)};
+		}
+
+		// Accepted connections wait here for a free worker. When the queue is full, accepting pauses and further
+		// connections wait in the listen backlog.
+		auto const thread_count = std::max(options.thread_count, 1u);
+		bounded_queue<socket_handle> connections{std::size_t{2} * thread_count};
+		std::vector<std::thread> workers;
+		for (unsigned i = 0; i < thread_count; ++i) {
+			workers.emplace_back([&] {
+				while (auto const s = connections.pop()) {
+					serve_connection(*s, options, assets);
+					close_socket(*s);
+				}
+			});
+		}
+
+		for (;;) {
+			auto const s = accept(listener, nullptr, nullptr);
+			if (s == invalid_socket) { continue; }
+			connections.push(s);
+		}
+	}
+}
@@ -0,0 +1,36 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief A long-running HTTP server that renders cards on request, keeping caches and render contexts warm.
+
+#pragma once
+
+#include <card-gen/backend.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+namespace cg {
+	struct server_options {
+		//! The local port to listen on. The server only accepts connections from this host.
+		std::uint16_t port = 8080;
+		//! The number of worker threads, each with its own render context. Also bounds the number of connections
+		//! being served at once; further connections wait to be accepted.
+		unsigned thread_count = 1;
+		render_backend const* backend = &get_gl_backend();
+		//! Requests with larger bodies are refused.
+		std::size_t max_body_size = std::size_t{16} << 20;
+		//! Requests for cards with more pixels than this, or with a side longer than 16384 pixels, are refused.
+		std::size_t max_card_pixels = std::size_t{4096} * 4096;
+		//! The directory that fonts and images must be in. Requests for cards that use assets elsewhere, including
+		//! through ".." or symbolic links, are refused, as are asset paths that are not spelled canonically.
+		std::filesystem::path asset_root = ".";
+	};
+
+	//! Serves card renders over HTTP on 127.0.0.1 until the process is interrupted. "POST /render" with a card's JSON
+	//! specification as the body responds with the rendered card, encoded as its output settings specify and as PNG
+	//! by default. "GET /health" responds with "ok". Each connection serves one request. The font, texture and base
+	//! layer caches and each worker's render textures persist between requests.
+	//! @throw std::runtime_error if the asset root does not exist or the server could not listen on the port.
+	auto serve(server_options const& options) -> void;
+}
@@ -0,0 +1,256 @@
+//! @file
+//! @copyright See <a href="LICENSE.txt">LICENSE.txt</a>.
+//! @brief Round-trip tests for the in-process image encoders: every PNG is decoded with zlib's inflate, which rejects
+//! streams that lenient decoders accept, such as incomplete Huffman codes. Also checks that saving an image leaves
+//! other hard links to the file it replaces unchanged.
+
+#include <card-gen/detail/image_encoder.hpp>
+#include <card-gen/detail/image_writer.hpp>
+
+#include <SFML/Graphics.hpp>
+#include <fmt/format.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+	auto read_big_endian(std::uint8_t const* data) -> std::uint32_t {
+		return std::uint32_t{data[0]} << 24 | std::uint32_t{data[1]} << 16 | std::uint32_t{data[2]} << 8 | data[3];
+	}
+
+	auto paeth(int a, int b, int c) -> int {
+		auto const p = a + b - c;
+		auto const pa = std::abs(p - a);
+		auto const pb = std::abs(p - b);
+		auto const pc = std::abs(p - c);
+		return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+	}
+
+	//! Decodes an 8-bit RGBA PNG written by encode_png, inflating with zlib.
+	//! @throw std::runtime_error if the PNG is malformed or zlib rejects its data.
+	auto decode_png(std::vector<std::uint8_t> const& png, sf::Vector2u& size) -> std::vector<std::uint8_t> {
+		if (png.size() < 8 || png[0] != 0x89 || png[1] != 'P') { throw std::runtime_error{"Missing PNG signature."}; }
+		std::vector<std::uint8_t> idat;
+		for (std::size_t offset = 8; offset + 12 <= png.size();) {
+			auto const length = read_big_endian(png.data() + offset);
+			std::string const type(png.begin() + offset + 4, png.begin() + offset + 8);
+			auto const data = png.data() + offset + 8;
+			if (type == "IHDR") { size = {read_big_endian(data), read_big_endian(data + 4)}; }
+			if (type == "IDAT") { idat.insert(idat.end(), data, data + length); }
+			offset += 12 + length;
+		}
+
+		std::size_t const row_size = std::size_t{4} * size.x;
+		std::vector<std::uint8_t> filtered((row_size + 1) * size.y);
+		auto filtered_size = static_cast<uLongf>(filtered.size());
+		auto const status = uncompress(filtered.data(), &filtered_size, idat.data(), static_cast<uLong>(idat.size()));
+		if (status != Z_OK) { throw std::runtime_error{fmt::format("zlib rejected the data (error {}).", status)}; }
+		if (filtered_size != filtered.size()) { throw std::runtime_error{"The data has the wrong size."}; }
+
+		std::vector<std::uint8_t> result(row_size * size.y);
+		for (std::size_t y = 0; y < size.y; ++y) {
+			auto const type = filtered[y * (row_size + 1)];
+			auto const in = filtered.data() + y * (row_size + 1) + 1;
+			auto const row = result.data() + y * row_size;
+			auto const above = y > 0 ? row - row_size : nullptr;
+			for (std::size_t i = 0; i < row_size; ++i) {
+				int const a = i >= 4 ? row[i - 4] : 0;
+				int const b = above ? above[i] : 0;
+				int const c = above && i >= 4 ? above[i - 4] : 0;
+				int predictor = 0;
+				switch (type) {
+					case 0: break;
+					case 1: predictor = a; break;
+					case 2: predictor = b; break;
+					case 3: predictor = (a + b) / 2; break;
+					case 4: predictor = paeth(a, b, c); break;
+					default: throw std::runtime_error{fmt::format("Unknown filter type {}.", type)};
+				}
+				row[i] = static_cast<std::uint8_t>(in[i] + predictor);
+			}
+		}
+		return result;
+	}
+
+	//! Decodes a QOI image written by encode_qoi.
+	auto decode_qoi(std::vector<std::uint8_t> const& qoi, sf::Vector2u& size) -> std::vector<std::uint8_t> {
+		if (qoi.size() < 22 || qoi[0] != 'q') { throw std::runtime_error{"Missing QOI signature."}; }
+		size = {read_big_endian(qoi.data() + 4), read_big_endian(qoi.data() + 8)};
+		std::vector<std::uint8_t> result;
+		std::vector<std::array<std::uint8_t, 4>> seen(64, std::array<std::uint8_t, 4>{});
+		std::array<std::uint8_t, 4> pixel{0, 0, 0, 255};
+		auto const push = [&] {
+			seen[(pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64] = pixel;
+			result.insert(result.end(), pixel.begin(), pixel.end());
+		};
+		for (std::size_t i = 14; i + 8 < qoi.size();) {
+			auto const tag = qoi[i++];
+			if (tag == 0xfe) {
+				pixel = {qoi[i], qoi[i + 1], qoi[i + 2], pixel[3]};
+				i += 3;
+			} else if (tag == 0xff) {
+				pixel = {qoi[i], qoi[i + 1], qoi[i + 2], qoi[i + 3]};
+				i += 4;
+			} else if (tag >> 6 == 0) {
+				pixel = seen[tag];
+			} else if (tag >> 6 == 1) {
+				pixel[0] = static_cast<std::uint8_t>(pixel[0] + (tag >> 4 & 3) - 2);
+				pixel[1] = static_cast<std::uint8_t>(pixel[1] + (tag >> 2 & 3) - 2);
+				pixel[2] = static_cast<std::uint8_t>(pixel[2] + (tag & 3) - 2);
+			} else if (tag >> 6 == 2) {
+				auto const dg = (tag & 63) - 32;
+				auto const next = qoi[i++];
+				pixel[0] = static_cast<std::uint8_t>(pixel[0] + dg - 8 + (next >> 4));
+				pixel[1] = static_cast<std::uint8_t>(pixel[1] + dg);
+				pixel[2] = static_cast<std::uint8_t>(pixel[2] + dg - 8 + (next & 15));
+			} else {
+				for (int run = 0; run < (tag & 63); ++run) {
+					result.insert(result.end(), pixel.begin(), pixel.end());
+				}
+			}
+			push();
+		}
+		return result;
+	}
+
+	auto make_image(unsigned width, unsigned height, std::function<sf::Color(unsigned, unsigned)> const& pixel)
+		-> sf::Image {
+		std::vector<sf::Uint8> pixels;
+		pixels.reserve(std::size_t{4} * width * height);
+		for (unsigned y = 0; y < height; ++y) {
+			for (unsigned x = 0; x < width; ++x) {
+				auto const color = pixel(x, y);
+				pixels.insert(pixels.end(), {color.r, color.g, color.b, color.a});
+			}
+		}
+		sf::Image result;
+		result.create(width, height, pixels.data());
+		return result;
+	}
+
+	struct test_image {
+		std::string name;
+		sf::Image image;
+	};
+
+	auto get_test_images() -> std::vector<test_image> {
+		std::mt19937 random{1};
+		auto const byte = [&] { return static_cast<sf::Uint8>(random() & 0xff); };
+		// Geometrically distributed values, whose optimal Huffman codes are longer than deflate allows.
+		auto const skewed_byte = [&] {
+			auto bits = random();
+			sf::Uint8 result = 0;
+			for (; bits & 1; bits >>= 1) {
+				++result;
+			}
+			return result;
+		};
+		std::vector<test_image> result;
+		result.push_back({"1x1", make_image(1, 1, [](unsigned, unsigned) { return sf::Color{1, 2, 3, 4}; })});
+		result.push_back({"flat", make_image(300, 200, [](unsigned, unsigned) { return sf::Color{40, 80, 120}; })});
+		result.push_back({"gradient", make_image(300, 200, [](unsigned x, unsigned y) {
+			return sf::Color(static_cast<sf::Uint8>(x), static_cast<sf::Uint8>(y), static_cast<sf::Uint8>(x + y));
+		})});
+		result.push_back({"noise", make_image(300, 200, [&](unsigned, unsigned) {
+			return sf::Color{byte(), byte(), byte(), byte()};
+		})});
+		// Skewed images need their code lengths limited; which codes overflow depends on the data, so try several.
+		for (int i = 0; i < 4; ++i) {
+			result.push_back({fmt::format("skewed {}", i), make_image(300, 200, [&](unsigned, unsigned) {
+				return sf::Color{skewed_byte(), skewed_byte(), skewed_byte(), skewed_byte()};
+			})});
+			// Mostly black cards, large enough to be deflated in several segments, with sparse specks.
+			result.push_back({fmt::format("mostly black card {}", i), make_image(750, 1050, [&](unsigned, unsigned) {
+				if (random() % (500 + 300 * i) == 0) { return sf::Color{byte(), byte(), byte()}; }
+				return sf::Color::Black;
+			})});
+		}
+		return result;
+	}
+
+	auto check_round_trip(test_image const& test,
+		std::string const& format,
+		std::vector<std::uint8_t> const& encoded,
+		decltype(decode_png)* decode) -> bool {
+		try {
+			sf::Vector2u size;
+			auto const decoded = decode(encoded, size);
+			auto const original = test.image.getPixelsPtr();
+			auto const original_size = test.image.getSize();
+			if (size != original_size) { throw std::runtime_error{"The decoded image has the wrong size."}; }
+			if (!std::equal(decoded.begin(), decoded.end(), original, original + decoded.size())
+				|| decoded.size() != std::size_t{4} * size.x * size.y) {
+				throw std::runtime_error{"The decoded pixels differ."};
+			}
+			return true;
+		} catch (std::exception const& ex) {
+			fmt::print("FAILED: {} as {}: {}\n", test.name, format, ex.what());
+			return false;
+		}
+	}
+
+	auto read_file(std::filesystem::path const& path) -> std::vector<std::uint8_t> {
+		std::ifstream fin{path, std::ios::binary};
+		return {std::istreambuf_iterator<char>{fin}, std::istreambuf_iterator<char>{}};
+	}
+
+	//! Saves over an output hard-linked to another, as rendering over a deduplicated output does, and checks that
+	//! the other output keeps its contents.
+	auto check_save_keeps_links() -> bool {
+		auto const dir = std::filesystem::temp_directory_path() / "card-gen-test";
+		std::filesystem::create_directories(dir);
+		auto const original_path = (dir / "original.png").string();
+		auto const duplicate_path = (dir / "duplicate.png").string();
+		test_image const original{"original", make_image(8, 8, [](unsigned, unsigned) { return sf::Color::Red; })};
+		test_image const duplicate{"duplicate", make_image(8, 8, [](unsigned, unsigned) { return sf::Color::Blue; })};
+
+		std::error_code ec;
+		std::filesystem::remove(duplicate_path, ec);
+		if (!cg::save_image(original.image, original_path)) {
+			fmt::print("FAILED: could not save \"{}\".\n", original_path);
+			return false;
+		}
+		std::filesystem::create_hard_link(original_path, duplicate_path, ec);
+		if (ec) {
+			fmt::print("Skipped the hard link test: {}\n", ec.message());
+			return true;
+		}
+		if (!cg::save_image(duplicate.image, duplicate_path)) {
+			fmt::print("FAILED: could not save \"{}\" over a hard link.\n", duplicate_path);
+			return false;
+		}
+		auto const format = "PNG saved over a hard link";
+		auto const original_ok = check_round_trip(original, format, read_file(original_path), decode_png);
+		auto const duplicate_ok = check_round_trip(duplicate, format, read_file(duplicate_path), decode_png);
+		return original_ok && duplicate_ok;
+	}
+}
+
+auto main() -> int {
+	int failures = 0;
+	int count = 0;
+	for (auto const& test : get_test_images()) {
+		for (int level = 0; level <= cg::max_compression_level; ++level) {
+			++count;
+			auto const png = cg::encode_png(test.image, level);
+			if (!check_round_trip(test, fmt::format("PNG level {}", level), png, decode_png)) { ++failures; }
+		}
+		++count;
+		if (!check_round_trip(test, "QOI", cg::encode_qoi(test.image), decode_qoi)) { ++failures; }
+	}
+	++count;
+	if (!check_save_keeps_links()) { ++failures; }
+	fmt::print("{} of {} tests passed.\n", count - failures, count);
+	return failures == 0 ? 0 : 1;
+}